@@ -0,0 +1,306 @@
+/*
+ * Bookkeeping of the file system block cache.
+ *
+ * A disk block in memory is mapped at DISKMAP + n * BLOCK_SIZE (see fs.c). At most BCACHE_NBLOCK
+ * blocks are cached; when the cache is full, a victim is chosen by the CLOCK algorithm with a
+ * software reference bit per block, written back if dirty and unmapped.
+ */
+
+// 文件系统的磁盘块缓存：
+// - 每个在内存中的磁盘块占据一个槽位，通过散列表由块号找到槽位
+// - 缓存已满时按照 CLOCK 算法选择被替换的磁盘块，访问时设置引用位，指针扫过时清除
+// - 常驻内存的磁盘块（超级块、位图、打开文件所在的目录块）、当前请求访问过的磁盘块、
+//   与客户进程共享的磁盘块不会被替换
+// - 记录所有脏块，写回时只需遍历脏块，而不必遍历整个磁盘
+
+#include "serv.h"
+#include <fsreq.h>
+
+// 散列表的桶数
+#define BCACHE_NHASH 256
+#define BCACHE_HASH(block_no) ((block_no) % BCACHE_NHASH)
+
+struct Bcache_slot {
+  // 槽位对应的磁盘块号
+  u_int bs_block_no;
+  // 散列表或空闲槽位链表中的下一个槽位，-1 表示结束
+  int bs_next;
+  // 最近一次访问时的请求序号
+  u_int bs_epoch;
+  // 固定的次数，大于 0 时不会被替换
+  u_short bs_pin;
+  // 在脏块数组中的下标，-1 表示不是脏块
+  int bs_dirty;
+  // 软件维护的引用位
+  u_char bs_ref;
+  // 槽位是否被使用
+  u_char bs_used;
+  // 固定期间被释放的磁盘块，取消最后一次固定时才真正释放
+  u_char bs_free_pending;
+};
+
+static struct Bcache_slot bcache_slots[BCACHE_NBLOCK];
+static int bcache_hash[BCACHE_NHASH];
+static int bcache_free;
+// CLOCK 算法的指针
+static u_int bcache_hand;
+// 当前请求的序号，当前请求访问过的磁盘块可能仍被其使用
+static u_int bcache_epoch;
+static struct Fsreq_cache_stat bcache_stat;
+// 所有脏块的槽位下标
+static int bcache_dirty[BCACHE_NBLOCK];
+static u_int bcache_ndirty;
+
+// Overview:
+//  Initialize the block cache: all slots are free.
+// 初始化磁盘块缓存
+void bcache_init(void) {
+  for (int i = 0; i < BCACHE_NHASH; i++) {
+    bcache_hash[i] = -1;
+  }
+  for (int i = 0; i < BCACHE_NBLOCK; i++) {
+    bcache_slots[i].bs_used = 0;
+    bcache_slots[i].bs_next = i + 1 < BCACHE_NBLOCK ? i + 1 : -1;
+  }
+  bcache_free = 0;
+  bcache_hand = 0;
+  bcache_ndirty = 0;
+  bcache_stat.req_max = BCACHE_NBLOCK;
+}
+
+// 由块号找到槽位，没有时返回 NULL
+static struct Bcache_slot *bcache_lookup(u_int block_no) {
+  for (int i = bcache_hash[BCACHE_HASH(block_no)]; i != -1; i = bcache_slots[i].bs_next) {
+    if (bcache_slots[i].bs_block_no == block_no) {
+      return &bcache_slots[i];
+    }
+  }
+  return NULL;
+}
+
+// 记录对槽位的访问
+static void bcache_touch(struct Bcache_slot *slot) {
+  slot->bs_ref = 1;
+  slot->bs_epoch = bcache_epoch;
+}
+
+// Overview:
+//  Choose a victim by the CLOCK algorithm, and unmap it (writing it back if dirty).
+//
+// Post-Condition:
+//  Return 0 on success, or -E_NO_MEM if every cached block is pinned, shared with clients or
+//  used by the current request.
+// 按照 CLOCK 算法替换一个磁盘块
+static int bcache_evict(void) {
+  // 第一遍扫描清除引用位，第二遍一定能找到未被引用的磁盘块
+  for (u_int n = 0; n < 2 * BCACHE_NBLOCK; n++) {
+    struct Bcache_slot *slot = &bcache_slots[bcache_hand];
+    bcache_hand = (bcache_hand + 1) % BCACHE_NBLOCK;
+
+    if (!slot->bs_used || slot->bs_pin > 0 || slot->bs_epoch == bcache_epoch) {
+      continue;
+    }
+    // 与客户进程共享的磁盘块，客户进程可能仍在读写
+    if (pageref(disk_addr(slot->bs_block_no)) > 1) {
+      continue;
+    }
+    if (slot->bs_ref) {
+      slot->bs_ref = 0;
+      continue;
+    }
+
+    // 脏块先写回磁盘，再取消映射，unmap_block 会释放槽位
+    unmap_block(slot->bs_block_no);
+    bcache_stat.req_evictions++;
+    return 0;
+  }
+
+  return -E_NO_MEM;
+}
+
+// Overview:
+//  Record a cache hit on block 'block_no', which is mapped.
+// 记录一次命中
+void bcache_hit(u_int block_no) {
+  struct Bcache_slot *slot = bcache_lookup(block_no);
+  if (slot != NULL) {
+    bcache_touch(slot);
+  }
+  bcache_stat.req_hits++;
+}
+
+// Overview:
+//  Allocate a slot for block 'block_no', which is about to be mapped, evicting another block
+//  if the cache is full.
+//
+// Post-Condition:
+//  Return 0 on success, or -E_NO_MEM if no block can be evicted.
+// 为即将载入内存的磁盘块分配槽位
+int bcache_insert(u_int block_no) {
+  struct Bcache_slot *slot = bcache_lookup(block_no);
+  if (slot != NULL) {
+    bcache_touch(slot);
+    return 0;
+  }
+
+  if (bcache_free == -1) {
+    try(bcache_evict());
+  }
+
+  int i = bcache_free;
+  slot = &bcache_slots[i];
+  bcache_free = slot->bs_next;
+
+  slot->bs_block_no = block_no;
+  slot->bs_pin = 0;
+  slot->bs_free_pending = 0;
+  slot->bs_dirty = -1;
+  slot->bs_used = 1;
+  bcache_touch(slot);
+  slot->bs_next = bcache_hash[BCACHE_HASH(block_no)];
+  bcache_hash[BCACHE_HASH(block_no)] = i;
+  bcache_stat.req_nblock++;
+  return 0;
+}
+
+// Overview:
+//  Record a cache miss on block 'block_no' and allocate a slot for it (see bcache_insert).
+// 记录一次缺失，并为磁盘块分配槽位
+int bcache_miss(u_int block_no) {
+  bcache_stat.req_misses++;
+  return bcache_insert(block_no);
+}
+
+// Overview:
+//  Record that block 'block_no' is loaded by read-ahead and allocate a slot for it (see
+//  bcache_insert).
+// 记录一次预读，并为磁盘块分配槽位
+int bcache_prefetch(u_int block_no) {
+  try(bcache_insert(block_no));
+  bcache_stat.req_readahead++;
+  return 0;
+}
+
+// 将槽位从脏块数组中移除，最后一个脏块填补其位置
+static void bcache_undirty(struct Bcache_slot *slot) {
+  if (slot->bs_dirty == -1) {
+    return;
+  }
+  int last = bcache_dirty[--bcache_ndirty];
+  bcache_dirty[slot->bs_dirty] = last;
+  bcache_slots[last].bs_dirty = slot->bs_dirty;
+  slot->bs_dirty = -1;
+}
+
+// Overview:
+//  Release the slot of block 'block_no', which has been unmapped.
+// 释放已经取消映射的磁盘块的槽位
+void bcache_remove(u_int block_no) {
+  int *link = &bcache_hash[BCACHE_HASH(block_no)];
+  while (*link != -1) {
+    int i = *link;
+    if (bcache_slots[i].bs_block_no == block_no) {
+      // 空闲的磁盘块被取消映射时可能仍是脏的
+      bcache_undirty(&bcache_slots[i]);
+      *link = bcache_slots[i].bs_next;
+      bcache_slots[i].bs_used = 0;
+      bcache_slots[i].bs_next = bcache_free;
+      bcache_free = i;
+      bcache_stat.req_nblock--;
+      return;
+    }
+    link = &bcache_slots[i].bs_next;
+  }
+}
+
+// Overview:
+//  Keep block 'block_no', which is mapped, in memory until bcache_unpin is called.
+// 固定磁盘块，使其常驻内存
+void bcache_pin(u_int block_no) {
+  struct Bcache_slot *slot = bcache_lookup(block_no);
+  user_assert(slot != NULL);
+  slot->bs_pin++;
+}
+
+// 取消对磁盘块的一次固定，固定期间被释放的磁盘块此时才释放
+void bcache_unpin(u_int block_no) {
+  struct Bcache_slot *slot = bcache_lookup(block_no);
+  user_assert(slot != NULL && slot->bs_pin > 0);
+  if (--slot->bs_pin == 0 && slot->bs_free_pending) {
+    slot->bs_free_pending = 0;
+    free_block(block_no);
+  }
+}
+
+// Overview:
+//  Called by 'free_block'. If block 'block_no' is pinned (an open file still points into it),
+//  record that it is to be freed when it is unpinned for the last time, and return 1; the block
+//  stays allocated and mapped until then. Otherwise return 0.
+// 固定的磁盘块推迟到取消固定时再释放
+int bcache_defer_free(u_int block_no) {
+  struct Bcache_slot *slot = bcache_lookup(block_no);
+  if (slot == NULL || slot->bs_pin == 0) {
+    return 0;
+  }
+  slot->bs_free_pending = 1;
+  return 1;
+}
+
+// Overview:
+//  Add block 'block_no', which is mapped, to the set of dirty blocks.
+// 记录脏块
+void bcache_set_dirty(u_int block_no) {
+  struct Bcache_slot *slot = bcache_lookup(block_no);
+  user_assert(slot != NULL);
+  if (slot->bs_dirty == -1) {
+    slot->bs_dirty = bcache_ndirty;
+    bcache_dirty[bcache_ndirty++] = slot - bcache_slots;
+  }
+}
+
+// Overview:
+//  Remove block 'block_no' from the set of dirty blocks after writing it back.
+// 脏块写回磁盘后不再记录
+void bcache_clear_dirty(u_int block_no) {
+  struct Bcache_slot *slot = bcache_lookup(block_no);
+  if (slot != NULL) {
+    bcache_undirty(slot);
+  }
+}
+
+// Overview:
+//  Copy the numbers of all dirty blocks, in no particular order, to 'blocks', which has room for
+//  BCACHE_NBLOCK numbers. Return the number of dirty blocks.
+// 获取所有脏块的块号
+u_int bcache_get_dirty(u_int *blocks) {
+  for (u_int i = 0; i < bcache_ndirty; i++) {
+    blocks[i] = bcache_slots[bcache_dirty[i]].bs_block_no;
+  }
+  return bcache_ndirty;
+}
+
+// 获取脏块的数目
+u_int bcache_dirty_count(void) {
+  return bcache_ndirty;
+}
+
+// Overview:
+//  Start serving a new request. Blocks accessed by earlier requests may be evicted from now on.
+// 开始处理新的请求
+void bcache_next_request(void) {
+  bcache_epoch++;
+}
+
+// Overview:
+//  Copy the statistics of the block cache to 'stat'.
+// 获取磁盘块缓存的统计信息
+void bcache_get_stat(struct Fsreq_cache_stat *stat) {
+  *stat = bcache_stat;
+  stat->req_ndirty = bcache_ndirty;
+  stat->req_npinned = 0;
+  for (int i = 0; i < BCACHE_NBLOCK; i++) {
+    if (bcache_slots[i].bs_used && bcache_slots[i].bs_pin > 0) {
+      stat->req_npinned++;
+    }
+  }
+}
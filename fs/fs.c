@@ -1,4 +1,5 @@
 #include "serv.h"
+#include <bitops.h>
 #include <mmu.h>
 
 struct Super *super;
@@ -6,6 +7,11 @@ struct Super *super;
 // 管理磁盘块的位图
 uint32_t *bitmap;
 
+// 每个位图块中空闲磁盘块的数目，分配时跳过没有空闲块的位图块
+static u_int bitmap_nfree[DISKMAX / BLOCK_SIZE / BLOCK_SIZE_BIT + 1];
+// 下一次分配开始查找的磁盘块号（next-fit）
+static u_int alloc_cursor;
+
 void file_flush(struct File *);
 int block_is_free(u_int);
 
@@ -16,6 +22,13 @@ void *disk_addr(u_int block_no) {
   return DISKMAP + block_no * BLOCK_SIZE;
 }
 
+// Overview:
+//  Return the number of the disk block whose cache page contains 'virtual_address'.
+// 获取虚存中的地址所在的磁盘块号，与 disk_addr 互逆
+u_int disk_block_no(void *virtual_address) {
+  return ((u_int)virtual_address - DISKMAP) / BLOCK_SIZE;
+}
+
 // Overview:
 //  Check if this virtual address is mapped to a block. (check PTE_V bit)
 // 检查虚拟地址是否已经存在映射关系，本质是在检查页表是否有效
@@ -66,8 +79,31 @@ int dirty_block(u_int block_no) {
   if (va_is_dirty(virtual_address)) {
     return 0;
   }
-  // 标记脏位的方式是修改页面权限
-  return syscall_mem_map(0, virtual_address, 0, virtual_address, PTE_D | PTE_DIRTY);
+  // 标记脏位的方式是修改页面权限，同时记录在脏块集合中
+  try(syscall_mem_map(0, virtual_address, 0, virtual_address, PTE_D | PTE_DIRTY));
+  bcache_set_dirty(block_no);
+  return 0;
+}
+
+// Overview:
+//  Mark this block as clean after it's written back to disk.
+// 磁盘块写回磁盘后清除脏位
+static void clean_block(u_int block_no) {
+  void *virtual_address = disk_addr(block_no);
+
+  if (va_is_dirty(virtual_address)) {
+    panic_on(syscall_mem_map(0, virtual_address, 0, virtual_address, PTE_D));
+    bcache_clear_dirty(block_no);
+  }
+}
+
+// Overview:
+//  Mark the block containing 'virtual_address' as dirty, after changing the metadata (a File
+//  structure, an indirect block or the bitmap) in it, so that it is written back before the block
+//  is evicted from the cache.
+// 修改元数据后将其所在的磁盘块标记为脏，使其在被替换出缓存前写回磁盘
+void dirty_va(void *virtual_address) {
+  panic_on(dirty_block(disk_block_no(virtual_address)));
 }
 
 // Overview:
@@ -82,6 +118,23 @@ void write_block(u_int block_no) {
   void *virtual_address = disk_addr(block_no);
   // 写一个磁盘块的内容
   ide_write(0, block_no * SECT2BLK, virtual_address, SECT2BLK);
+  clean_block(block_no);
+}
+
+// Overview:
+//  Write 'nblock' consecutive blocks starting at 'block_no', which are all in memory, out to disk
+//  with one multi-sector IDE command.
+// 一次写回连续的多个磁盘块，它们在内存中的地址同样连续
+void write_blocks(u_int block_no, u_int nblock) {
+  for (u_int n = 0; n < nblock; n++) {
+    if (!block_is_mapped(block_no + n)) {
+      user_panic("write unmapped block %08x", block_no + n);
+    }
+  }
+  ide_write(0, block_no * SECT2BLK, disk_addr(block_no), nblock * SECT2BLK);
+  for (u_int n = 0; n < nblock; n++) {
+    clean_block(block_no + n);
+  }
 }
 
 // Overview:
@@ -96,6 +149,9 @@ void write_block(u_int block_no) {
 //  to 1 if the block was loaded off disk to satisfy this request. (Isnew
 //  lets callers like file_get_block clear any memory-only fields
 //  from the disk blocks when they come in off disk.)
+//
+//  Loading a block may evict another one from the block cache (see bcache.c); blocks used by
+//  the current request are never evicted.
 // 将指定编号的磁盘块读入到内存中，将内存中的虚拟地址保存到指针中
 // 自动处理原先未分配物理内存的情况
 int read_block(u_int block_no,  // 读取的磁盘块的块号
@@ -114,20 +170,27 @@ int read_block(u_int block_no,  // 读取的磁盘块的块号
 
   // 获取磁盘块在虚拟内存中的相应地址
   void *virtual_address = disk_addr(block_no);
+  int func_info;
 
   // 如果磁盘块原先已经被读入内存，不需要操作
   if (block_is_mapped(block_no)) {
     if (if_not_mapped_before) {
       *if_not_mapped_before = 0;
     }
+    bcache_hit(block_no);
   }
   // 如果没有，则分配内存，从磁盘中读取数据
   else {
     if (if_not_mapped_before) {
       *if_not_mapped_before = 1;
     }
+    // 分配缓存槽位，缓存已满时替换一个磁盘块
+    try(bcache_miss(block_no));
     // 分配物理内存
-    try(syscall_mem_alloc(0, virtual_address, PTE_D));
+    if ((func_info = syscall_mem_alloc(0, virtual_address, PTE_D)) < 0) {
+      bcache_remove(block_no);
+      return func_info;
+    }
     // 读取一整个磁盘块的内容
     // 利用乘得到读取的扇区号，读取一个磁盘块的内容
     ide_read(0, block_no * SECT2BLK, virtual_address, SECT2BLK);
@@ -141,6 +204,37 @@ int read_block(u_int block_no,  // 读取的磁盘块的块号
   return 0;
 }
 
+// Overview:
+//  Load 'nblock' consecutive disk blocks starting at 'block_no', none of which is in memory.
+//  Their cache pages are consecutive too, so they are read with one multi-sector IDE command.
+//
+// Post-Condition:
+//  Return the number of blocks loaded, which is less than 'nblock' if the cache or memory runs
+//  out, or a negative error code if none is loaded.
+// 一次读入连续的多个磁盘块，它们在内存中的地址同样连续
+int read_blocks(u_int block_no, u_int nblock) {
+  u_int n;
+  int func_info = 0;
+
+  // 为每个磁盘块分配缓存槽位与物理内存
+  for (n = 0; n < nblock; n++) {
+    if ((func_info = bcache_prefetch(block_no + n)) < 0) {
+      break;
+    }
+    if ((func_info = syscall_mem_alloc(0, disk_addr(block_no + n), PTE_D)) < 0) {
+      bcache_remove(block_no + n);
+      break;
+    }
+  }
+  if (n == 0) {
+    return func_info;
+  }
+
+  // 一条命令读取所有磁盘块的扇区
+  ide_read(0, block_no * SECT2BLK, disk_addr(block_no), n * SECT2BLK);
+  return n;
+}
+
 // Overview:
 //  Allocate a page to cache the disk block.
 // 为磁盘块在内存中分配物理内存，建立映射
@@ -150,8 +244,14 @@ int map_block(u_int block_no) {
     return 0;
   }
 
+  // 分配缓存槽位，缓存已满时替换一个磁盘块
+  try(bcache_insert(block_no));
   // 为磁盘在内存中分配物理内存，权限设置为可写
-  try(syscall_mem_alloc(env->env_id, disk_addr(block_no), PTE_D));
+  int func_info = syscall_mem_alloc(env->env_id, disk_addr(block_no), PTE_D);
+  if (func_info < 0) {
+    bcache_remove(block_no);
+  }
+  return func_info;
 }
 
 // Overview:
@@ -170,6 +270,8 @@ void unmap_block(u_int block_no) {
   syscall_mem_unmap(env->env_id, disk_addr(block_no));
   // 检查是否真的已经取消了映射关系
   user_assert(!block_is_mapped(block_no));
+  // 释放缓存槽位
+  bcache_remove(block_no);
 }
 
 // Overview:
@@ -192,7 +294,10 @@ int block_is_free(u_int block_no) {
 }
 
 // Overview:
-//  Mark a block as free in the bitmap.
+//  Mark a block as free in the bitmap, and drop it from the cache. Its cache page may still be
+//  mapped by other envs (e.g. as the text of a spawned program, see 'load_icode_mapper' in the
+//  kernel), so it must not be reused for the next allocation of the block, which gets a fresh
+//  zero page instead. A pinned block is freed only when it is unpinned (see 'bcache_defer_free').
 // 通过位图设置第no个磁盘块为空闲
 void free_block(u_int block_no) {
   // 判断磁盘块号是否合法
@@ -200,29 +305,86 @@ void free_block(u_int block_no) {
     return;
   }
 
-  // 设置位图为1，将磁盘块标记为空闲
+  // 已经是空闲的
+  if (block_is_free(block_no)) {
+    return;
+  }
+  // 打开的文件仍然指向固定的磁盘块（如被删除的目录中的文件控制块），取消固定后再释放
+  if (bcache_defer_free(block_no)) {
+    return;
+  }
+  // 设置位图为1，将磁盘块标记为空闲，位图块随脏块一起写回
   bitmap[block_no / 32] |= 1 << (block_no % 32);
+  bitmap_nfree[block_no / BLOCK_SIZE_BIT]++;
+  dirty_va(&bitmap[block_no / 32]);
+  // 空闲的磁盘块不必写回，直接取消映射；其他进程仍映射的旧页面不会被覆盖
+  if (block_is_mapped(block_no)) {
+    unmap_block(block_no);
+  }
 }
 
 // Overview:
-//  Search in the bitmap for a free block and allocate it.
+//  Find the first free block in ['start', 'end') via bitmap, a word at a time, skipping
+//  bitmap blocks that have no free block.
 //
 // Post-Condition:
-//  Return block number allocated on success,
-//  Return -E_NO_DISK if we are out of blocks.
-// 获得一个空闲磁盘块，返回其磁盘块号
-int alloc_block_num(void) {
-  int block_no;
-  // 遍历位图，找到一个空闲磁盘块
-  // 返回前写回磁盘块的内容到磁盘
-  for (block_no = 3; block_no < super->s_nblocks; block_no++) {
-    // 通过位图判断磁盘块未被使用
-    if (bitmap[block_no / 32] & (1 << (block_no % 32))) {
-      // 将这个磁盘块标记为在被使用
-      bitmap[block_no / 32] &= ~(1 << (block_no % 32));
-      // 将磁盘块的内容写回到磁盘中去
-      write_block(block_no / BLOCK_SIZE_BIT + 2); // write to disk.
+//  Return the block number, or -1 if there is no free block in the range.
+// 在位图中查找一个范围内的第一个空闲磁盘块，每次检查一个字
+static int bitmap_find_free(u_int start, u_int end) {
+  u_int block_no = start;
+
+  while (block_no < end) {
+    // 整个位图块都没有空闲块，跳过
+    if (bitmap_nfree[block_no / BLOCK_SIZE_BIT] == 0) {
+      block_no = ROUND(block_no + 1, BLOCK_SIZE_BIT);
+      continue;
+    }
+    // 忽略字中 block_no 之前的位
+    int bit = ffs32(bitmap[block_no / 32] & (~0u << (block_no % 32)));
+    if (bit >= 0) {
+      block_no = ROUNDDOWN(block_no, 32) + bit;
+      return block_no < end ? block_no : -1;
+    }
+    block_no = ROUND(block_no + 1, 32);
+  }
 
+  return -1;
+}
+
+// Overview:
+//  Search in the bitmap for 'nblock' contiguous free blocks and allocate them. The search is
+//  next-fit: it starts where the last allocation ended and wraps around once.
+//  The bitmap is only marked dirty; it's written back with the other dirty blocks.
+//
+// Post-Condition:
+//  Return the first block number allocated on success,
+//  Return -E_NO_DISK if we are out of blocks (or there is no such run).
+// 获得连续的 nblock 个空闲磁盘块，返回第一个磁盘块号
+int alloc_block_num_run(u_int nblock) {
+  // 先查找游标之后的部分，再从头查找游标之前的部分
+  for (int pass = 0; pass < 2; pass++) {
+    u_int start = pass == 0 ? alloc_cursor : 0;
+    u_int end = pass == 0 ? super->s_nblocks : MIN(alloc_cursor, super->s_nblocks);
+    int block_no;
+
+    while ((block_no = bitmap_find_free(start, end)) >= 0) {
+      // 检查之后的磁盘块是否空闲
+      u_int len = 1;
+      while (len < nblock && block_is_free(block_no + len)) {
+        len++;
+      }
+      if (len < nblock) {
+        start = block_no + len;
+        continue;
+      }
+
+      // 将这些磁盘块标记为在被使用，位图块标记为脏
+      for (u_int n = block_no; n < block_no + nblock; n++) {
+        bitmap[n / 32] &= ~(1 << (n % 32));
+        bitmap_nfree[n / BLOCK_SIZE_BIT]--;
+        dirty_va(&bitmap[n / 32]);
+      }
+      alloc_cursor = block_no + nblock;
       return block_no;
     }
   }
@@ -231,28 +393,62 @@ int alloc_block_num(void) {
 }
 
 // Overview:
-//  Allocate a block -- first find a free block in the bitmap, then map it into memory.
-// 找到一个空闲的磁盘块，返回对应的磁盘块号
-int alloc_block(void) {
+//  Search in the bitmap for a free block and allocate it.
+//
+// Post-Condition:
+//  Return block number allocated on success,
+//  Return -E_NO_DISK if we are out of blocks.
+// 获得一个空闲磁盘块，返回其磁盘块号
+int alloc_block_num(void) {
+  return alloc_block_num_run(1);
+}
+
+// Overview:
+//  Allocate 'nblock' contiguous blocks -- first find them in the bitmap, then map them into
+//  memory. The new blocks are zero-filled and marked dirty, so that they are written back before
+//  being evicted, instead of being read back with the stale contents on disk.
+//
+// Post-Condition:
+//  Return the first block number allocated on success, or a negative error code.
+// 找到连续的空闲磁盘块，返回第一个磁盘块号
+int alloc_block_run(u_int nblock) {
   int block_no;
   int func_info;
 
-  // 找到一个磁盘块
-  if ((block_no = alloc_block_num()) < 0) {
+  // 找到连续的磁盘块
+  if ((block_no = alloc_block_num_run(nblock)) < 0) {
     return block_no;
   }
 
   // 将磁盘块加载到内存中：建立映射
-  if ((func_info = map_block(block_no)) < 0) {
-    // 如果失败，则不占用磁盘，恢复位图
-    free_block(block_no);
-    return func_info;
+  for (u_int n = 0; n < nblock; n++) {
+    if ((func_info = map_block(block_no + n)) < 0) {
+      // 如果失败，则不占用磁盘，恢复位图
+      for (u_int i = 0; i < nblock; i++) {
+        if (i < n) {
+          unmap_block(block_no + i);
+        }
+        free_block(block_no + i);
+      }
+      return func_info;
+    }
+  }
+  // 新分配的磁盘块全为0，同样需要写回磁盘，否则被替换出缓存后会读到磁盘上的旧数据
+  for (u_int n = 0; n < nblock; n++) {
+    panic_on(dirty_block(block_no + n));
   }
 
   // 返回磁盘块号
   return block_no;
 }
 
+// Overview:
+//  Allocate a block -- first find a free block in the bitmap, then map it into memory.
+// 找到一个空闲的磁盘块，返回对应的磁盘块号
+int alloc_block(void) {
+  return alloc_block_run(1);
+}
+
 // Overview:
 //  Read and validate the file system super-block.
 //
@@ -277,6 +473,10 @@ void read_super(void) {
   if (super->s_nblocks > DISKMAX / BLOCK_SIZE) {
     user_panic("file system is too large");
   }
+  // 检查文件系统的特性，旧的磁盘镜像没有任何特性
+  if (super->s_features & ~FS_FEATURES_SUPPORTED) {
+    user_panic("unsupported file system features %x", super->s_features);
+  }
 
   debugf("superblock is good\n");
 }
@@ -304,9 +504,22 @@ void read_bitmap(void) {
   user_assert(!block_is_free(0));
   user_assert(!block_is_free(1));
 
-  // 确定位图所有所需块被载入内存
+  // 确定位图所有所需块被载入内存，并使其常驻内存
   for (int i = 0; i < bitmap_block_num; i++) {
     user_assert(!block_is_free(i + 2));
+    bcache_pin(i + 2);
+  }
+
+  // 统计每个位图块中的空闲磁盘块数
+  for (u_int block_no = 0; block_no < super->s_nblocks; block_no += 32) {
+    uint32_t word = bitmap[block_no / 32];
+    // 忽略超出磁盘的位
+    if (super->s_nblocks - block_no < 32) {
+      word &= (1u << (super->s_nblocks - block_no)) - 1;
+    }
+    for (; word != 0; word &= word - 1) {
+      bitmap_nfree[block_no / BLOCK_SIZE_BIT]++;
+    }
   }
 
   debugf("read_bitmap is good\n");
@@ -329,7 +542,7 @@ void check_write_block(void) {
   user_assert(block_is_mapped(1));
 
   // clear it out
-  panic_on(syscall_mem_unmap(0, disk_addr(1)));
+  unmap_block(1);
   user_assert(!block_is_mapped(1));
 
   // validate the data read from the disk.
@@ -349,27 +562,70 @@ void check_write_block(void) {
 //  2. check if the disk can work.
 //  3. read bitmap blocks from disk to memory.
 void fs_init(void) {
+  // 初始化磁盘块缓存
+  bcache_init();
   // 检查超级块
   read_super();
   // 检查磁盘能否工作
   check_write_block();
+  // 超级块常驻内存
+  bcache_pin(1);
   // 检查位图
   read_bitmap();
 }
 
+// Overview:
+//  Return the maximum number of blocks of a file: files may use the double-indirect block only
+//  if the super block has FS_FEATURE_DINDIRECT.
+// 文件最多占据的磁盘块数，取决于文件系统是否支持二级间接指针
+static u_int file_max_blocks(void) {
+  if (super->s_features & FS_FEATURE_DINDIRECT) {
+    return MAXFILESIZE_DINDIRECT / BLOCK_SIZE;
+  }
+  return NINDIRECT;
+}
+
+// Overview:
+//  Read the index block (an indirect or double-indirect block) whose number is in
+//  '*block_no_pointer' and set '*block_va' to it. When the slot is empty and 'alloc' is set,
+//  allocate a zeroed index block and record it in the slot.
+//
+// Post-Condition:
+//  Return 0 on success, -E_NOT_FOUND if the slot is empty and alloc was 0, or the underlying
+//  error.
+// 读入索引磁盘块（间接指针或二级间接指针磁盘块），没有时按alloc分配
+static int file_index_block(uint32_t *block_no_pointer, u_int alloc, uint32_t **block_va) {
+  if (*block_no_pointer == 0) {
+    // 不需要获取磁盘块，报错
+    if (alloc == 0) {
+      return -E_NOT_FOUND;
+    }
+
+    int block_no;
+    if ((block_no = alloc_block()) < 0) {
+      return block_no;
+    }
+    *block_no_pointer = block_no;
+    dirty_va(block_no_pointer);
+  }
+
+  return read_block(*block_no_pointer, (void **)block_va, 0);
+}
+
 // Overview:
 //  Like pgdir_walk but for files.
 //  Find the disk block number slot for the 'file_block_no'th block in file 'f'.
 //  Then, set '*ppdiskblock_no' to point to that slot.
-//  The slot will be one of the f->f_direct[] entries, or an entry in the indirect block.
-//  When 'alloc' is set, this function will allocate an indirect block if necessary.
+//  The slot will be one of the f->f_direct[] entries, an entry in the indirect block, or (beyond
+//  NINDIRECT blocks) an entry in an indirect block of the double-indirect block.
+//  When 'alloc' is set, this function will allocate index blocks if necessary.
 //
 // Post-Condition:
 //  Return 0 on success, and set *ppdiskblock_no to the pointer to the target block.
 //  Return -E_NOT_FOUND if the function needed to allocate an indirect block, but alloc was 0.
 //  Return -E_NO_DISK if there's no space on the disk for an indirect block.
 //  Return -E_NO_MEM if there's not enough memory for an indirect block.
-//  Return -E_INVAL if file_block_no is out of range (>= NINDIRECT).
+//  Return -E_INVAL if file_block_no is out of range (>= file_max_blocks()).
 // 找到文件的第f_no个磁盘块，将文件控制块中存磁盘块号的地址保存到指针中
 // 按照alloc设置加载到内存中
 int file_block_walk(struct File *file,  // 操作的文件
@@ -388,29 +644,26 @@ int file_block_walk(struct File *file,  // 操作的文件
   }
   // 由间接指针控制
   else if (file_block_no < NINDIRECT) {
-    // 如果没有保存间接指针的磁盘块
-    // 按alloc获取
-    if (file->f_indirect == 0) {
-      // 不需要获取磁盘块，报错
-      if (alloc == 0) {
-        return -E_NOT_FOUND;
-      }
-
-      // 获取一个磁盘块用作间接指针区域
-      int block_no;
-      if ((block_no = alloc_block()) < 0) {
-        return block_no;
-      }
-      file->f_indirect = block_no;
-    }
-
-    // 将指定编号的磁盘块读入到内存中
-    if ((func_info = read_block(file->f_indirect, (void **)&block_va, 0)) < 0) {
+    // 读入间接指针磁盘块，如果没有，按alloc获取
+    if ((func_info = file_index_block(&file->f_indirect, alloc, &block_va)) < 0) {
       return func_info;
     }
     // 保存磁盘块号 对应的指针 为 保存指针的磁盘地址+偏移量
     block_no_pointer = block_va + file_block_no;
   }
+  // 由二级间接指针控制：先找到间接指针磁盘块，再找到其中的指针
+  else if (file_block_no < file_max_blocks()) {
+    u_int index = file_block_no - NINDIRECT;
+    uint32_t *dindirect_va;
+
+    if ((func_info = file_index_block(&file->f_dindirect, alloc, &dindirect_va)) < 0) {
+      return func_info;
+    }
+    if ((func_info = file_index_block(&dindirect_va[index / NINDIRECT], alloc, &block_va)) < 0) {
+      return func_info;
+    }
+    block_no_pointer = block_va + index % NINDIRECT;
+  }
   // 错误的磁盘块号
   else {
     return -E_INVAL;
@@ -454,6 +707,7 @@ int file_map_block(struct File *file, u_int file_block_no, u_int *disk_block_no,
       return func_info;
     }
     *block_no_pointer = func_info;
+    dirty_va(block_no_pointer);
   }
 
   // 将对应的结果保存到指针中
@@ -468,15 +722,16 @@ int file_clear_block(struct File *file, u_int file_block_no) {
   uint32_t *block_no_pointer;
   int func_info;
 
-  // 获取文件的第f_no个磁盘控制块，保存到指针中
+  // 获取文件的第f_no个磁盘控制块，保存到指针中；索引块不存在时磁盘块也不存在
   if ((func_info = file_block_walk(file, file_block_no, &block_no_pointer, 0)) < 0) {
-    return func_info;
+    return func_info == -E_NOT_FOUND ? 0 : func_info;
   }
 
   // 磁盘块有效
   if (*block_no_pointer) {
     free_block(*block_no_pointer);
     *block_no_pointer = 0;
+    dirty_va(block_no_pointer);
   }
 
   return 0;
@@ -508,6 +763,79 @@ int file_get_block(struct File *file, u_int file_block_no, void **block_va_point
   return 0;
 }
 
+// Overview:
+//  Load the blocks 'file_block_no' to 'file_block_no' + 'nblock' - 1 of 'file' (up to the end of
+//  the file) that are not in memory yet. Blocks consecutive on the disk are read together, at
+//  most RA_MAX_BLOCKS with one IDE command. Holes are skipped and nothing is allocated.
+//
+//  This is only an optimization: it stops silently on errors, which the later
+//  'file_get_block' reports.
+// 预读文件的多个磁盘块，磁盘上连续的磁盘块一次读入
+void file_read_ahead(struct File *file, u_int file_block_no, u_int nblock) {
+  u_int end = MIN(file_block_no + nblock, ROUND(file->f_size, BLOCK_SIZE) / BLOCK_SIZE);
+  // 当前连续且不在内存中的一段磁盘块
+  u_int run_start = 0, run_len = 0;
+
+  for (u_int i = file_block_no; i <= end; i++) {
+    u_int block_no = 0;
+    int loadable = i < end && file_map_block(file, i, &block_no, 0) == 0 &&
+                   !block_is_mapped(block_no);
+
+    // 与当前一段连续，加入其中
+    if (loadable && run_len > 0 && block_no == run_start + run_len && run_len < RA_MAX_BLOCKS) {
+      run_len++;
+      continue;
+    }
+    // 读入当前一段，读入不完整时停止预读
+    if (run_len > 0 && read_blocks(run_start, run_len) != run_len) {
+      return;
+    }
+    run_start = block_no;
+    run_len = loadable;
+  }
+}
+
+// Overview:
+//  Allocate the missing blocks of 'file' among the blocks 'file_block_no' to
+//  'file_block_no' + 'nblock' - 1 (up to the end of the file), each run of missing blocks with a
+//  single 'alloc_block_run', so that it is contiguous on disk. A run that can't be allocated
+//  contiguously is split in halves.
+//
+//  This is only an optimization: it stops silently on errors, and 'file_get_block' allocates
+//  the remaining blocks one by one.
+// 为文件中连续的未分配文件块分配磁盘上连续的磁盘块
+void file_alloc_blocks(struct File *file, u_int file_block_no, u_int nblock) {
+  u_int end = MIN(file_block_no + nblock, ROUND(file->f_size, BLOCK_SIZE) / BLOCK_SIZE);
+  uint32_t *block_no_pointer;
+
+  for (u_int i = file_block_no; i < end;) {
+    // 找到一段连续的未分配的文件块
+    u_int len = 0;
+    while (i + len < end && file_block_walk(file, i + len, &block_no_pointer, 1) == 0 &&
+           *block_no_pointer == 0) {
+      len++;
+    }
+    if (len == 0) {
+      i++;
+      continue;
+    }
+
+    // 分配连续的磁盘块，失败时减半长度
+    int block_no;
+    while ((block_no = alloc_block_run(len)) < 0) {
+      if ((len /= 2) == 0) {
+        return;
+      }
+    }
+    for (u_int n = 0; n < len; n++) {
+      panic_on(file_block_walk(file, i + n, &block_no_pointer, 1));
+      *block_no_pointer = block_no + n;
+      dirty_va(block_no_pointer);
+    }
+    i += len;
+  }
+}
+
 // Overview:
 //  Mark the offset/BLOCK_SIZE'th block dirty in file f.
 // 将文件控制块标记为脏
@@ -588,6 +916,7 @@ int dir_alloc_file(struct File *dictionary, struct File **file_pointer) {
 
   // 原目录的磁盘块下没有空余的文件控制块
   dictionary->f_size += BLOCK_SIZE;
+  dirty_va(dictionary);
   // 为目录增加一个磁盘块
   if ((func_info = file_get_block(dictionary, block_num, &block)) < 0) {
     return func_info;
@@ -732,6 +1061,7 @@ int file_create(char *path, struct File **file_pointer) {
   }
   // 为文件控制块拷贝名字
   strcpy(file->f_name, name);
+  dirty_va(file);
 
   *file_pointer = file;
   return 0;
@@ -748,6 +1078,29 @@ int file_create(char *path, struct File **file_pointer) {
 //  If the new_nblocks is no more than NDIRECT, free the indirect block too.
 //  (Remember to clear the f->f_indirect pointer so you'll know whether it's valid!)
 //
+// 释放二级间接指针下不再使用的间接指针磁盘块，文件不超过 NINDIRECT 块时一并释放二级间接指针磁盘块
+static void file_truncate_dindirect(struct File *file, u_int new_nblock_num) {
+  uint32_t *dindirect_va;
+
+  if (!(super->s_features & FS_FEATURE_DINDIRECT) || file->f_dindirect == 0) {
+    return;
+  }
+
+  panic_on(read_block(file->f_dindirect, (void **)&dindirect_va, 0));
+  for (u_int i = 0; i < NINDIRECT; i++) {
+    // 第i个间接指针磁盘块负责的文件块都不再使用
+    if (dindirect_va[i] != 0 && NINDIRECT + i * NINDIRECT >= new_nblock_num) {
+      free_block(dindirect_va[i]);
+      dindirect_va[i] = 0;
+      dirty_va(&dindirect_va[i]);
+    }
+  }
+  if (new_nblock_num <= NINDIRECT) {
+    free_block(file->f_dindirect);
+    file->f_dindirect = 0;
+  }
+}
+
 // Hint: use file_clear_block.
 // 缩小文件尺寸至new_size
 void file_truncate(struct File *file, u_int new_size) {
@@ -777,20 +1130,29 @@ void file_truncate(struct File *file, u_int new_size) {
       panic_on(file_clear_block(file, block_no));
     }
   }
+  // 释放二级间接指针下不再使用的磁盘块
+  file_truncate_dindirect(file, new_nblock_num);
   // 设置新大小
   file->f_size = new_size;
+  dirty_va(file);
 }
 
 // Overview:
 //  Set file size to newsize.
+//  Return -E_NO_DISK if newsize is beyond the maximum file size of the file system.
 // 将文件设置为新大小，判断了
 int file_set_size(struct File *file, u_int new_size) {
+  // 超出文件的最大大小
+  if (new_size > file_max_blocks() * BLOCK_SIZE) {
+    return -E_NO_DISK;
+  }
   // 如果是缩小尺寸，清空不用的磁盘块
   if (file->f_size > new_size) {
     file_truncate(file, new_size);
   }
   // 多余情况直接设置
   file->f_size = new_size;
+  dirty_va(file);
   // 写回文件夹
   if (file->f_dir) {
     file_flush(file->f_dir);
@@ -810,6 +1172,12 @@ void file_flush(struct File *file) {
   u_int block_num = ROUND(file->f_size, BLOCK_SIZE) / BLOCK_SIZE;
   u_int disk_no;
 
+  // 脏块不比文件的磁盘块多时，写回所有脏块，代价只与脏数据量有关
+  if (bcache_dirty_count() <= block_num) {
+    fs_sync();
+    return;
+  }
+
   // 遍历文件的磁盘块
   for (int block_no = 0; block_no < block_num; block_no++) {
     // 获取文件的磁盘块对应的磁盘块号
@@ -823,16 +1191,46 @@ void file_flush(struct File *file) {
   }
 }
 
+// 对磁盘块号排序（希尔排序）
+static void sort_blocks(u_int *blocks, u_int n) {
+  for (u_int gap = n / 2; gap > 0; gap /= 2) {
+    for (u_int i = gap; i < n; i++) {
+      u_int block_no = blocks[i];
+      u_int j = i;
+      for (; j >= gap && blocks[j - gap] > block_no; j -= gap) {
+        blocks[j] = blocks[j - gap];
+      }
+      blocks[j] = block_no;
+    }
+  }
+}
+
 // Overview:
 //  Sync the entire file system.  A big hammer.
-// 同步文件系统
+//  Only the dirty blocks recorded by the block cache are visited, in increasing block order, so
+//  that consecutive dirty blocks are written with one IDE command. Dirty blocks that have been
+//  freed are not written.
+// 同步文件系统：按块号顺序写回所有脏块，连续的脏块一次写回
 void fs_sync(void) {
-  // 遍历文件系统所有磁盘块
-  for (int block_no = 0; block_no < super->s_nblocks; block_no++) {
-    // 如果有修改，则写回至磁盘
-    if (block_is_dirty(block_no)) {
-      write_block(block_no);
+  static u_int blocks[BCACHE_NBLOCK];
+  u_int n = bcache_get_dirty(blocks);
+  sort_blocks(blocks, n);
+
+  for (u_int i = 0; i < n;) {
+    // 空闲的磁盘块不需要写回
+    if (block_is_free(blocks[i])) {
+      clean_block(blocks[i]);
+      i++;
+      continue;
+    }
+    // 找到一段连续的、被使用的脏块，至多为一条 IDE 命令的长度
+    u_int len = 1;
+    while (i + len < n && len < RA_MAX_BLOCKS && blocks[i + len] == blocks[i] + len &&
+           !block_is_free(blocks[i + len])) {
+      len++;
     }
+    write_blocks(blocks[i], len);
+    i += len;
   }
 }
 
@@ -865,6 +1263,7 @@ int file_remove(char *path) {
   file_truncate(file, 0);
   // 将文件名清空，不移除，只删名字，后续遇到约定俗成
   file->f_name[0] = '\0';
+  dirty_va(file);
   // 将文件有修改的部分写回到磁盘
   file_flush(file);
   // 文件有目录，去除目录信息
@@ -10,8 +10,10 @@
 /* Overview:
  *   Wait for the IDE device to complete previous requests and be ready
  *   to receive subsequent requests.
+ *   While the device is busy, block until its interrupt with 'syscall_ide_wait'; fall back to
+ *   yielding if the kernel hasn't enabled the IDE interrupt.
  */
-// 等待IDE的操作就绪，当没有就绪时忙等待
+// 等待IDE的操作就绪，没有就绪时阻塞等待磁盘中断
 static uint8_t wait_ide_ready() {
   uint8_t flag;
   while (1) {
@@ -20,17 +22,97 @@ static uint8_t wait_ide_ready() {
     if ((flag & MALTA_IDE_BUSY) == 0) {
       break;
     }
-    // 避免CPU轮询，对CPU更友好
-    syscall_yield();
+    // 等待磁盘中断；中断可能早于本次等待到达，因此返回后需要重新检查状态
+    if (syscall_ide_wait() < 0) {
+      // 避免CPU轮询，对CPU更友好
+      syscall_yield();
+    }
   }
 
   return flag;
 }
 
+/* Overview:
+ *   Wait for the IDE device to be ready to transfer the next sector of the current command.
+ *
+ * Post-Condition:
+ *   Panic if the device reports an error, or doesn't request data.
+ */
+// 等待IDE设备请求传输下一个扇区的数据（DRQ）
+static void wait_ide_drq() {
+  uint8_t flag = wait_ide_ready();
+  if (flag & MALTA_IDE_STAT_ERR) {
+    user_panic("ide: command failed, status %02x", flag);
+  }
+  if (!(flag & MALTA_IDE_DRQ)) {
+    user_panic("ide: device doesn't request data, status %02x", flag);
+  }
+}
+
+/* Overview:
+ *   Set the first sector number 'sec_no', the number of sectors 'nsect' (at most
+ *   MALTA_IDE_MAX_NSECT) and the disk number 'disk_no' of an operation, and issue the command
+ *   'cmd'. The register writes are submitted to the syscall ring and run with a single trap into
+ *   the kernel.
+ */
+// 设置操作的扇区与磁盘，并发出读写命令
+static void ide_issue(u_int disk_no, u_int sec_no, u_int nsect, uint8_t cmd) {
+  // 批量的系统调用在提交之后才执行，每个寄存器的值需要单独存放
+  uint8_t regs[6];
+
+  // 设置操作扇区数目  NSECT，256 个扇区写作 0
+  regs[0] = nsect & 0xff;
+  sysring_submit(SYS_write_dev, (u_int)&regs[0], MALTA_IDE_NSECT, 1, 0, 0);
+
+  // 设置操作扇区号的[7:0]位  LBAL
+  regs[1] = sec_no & 0xff;
+  sysring_submit(SYS_write_dev, (u_int)&regs[1], MALTA_IDE_LBAL, 1, 0, 0);
+
+  // 设置操作扇区号的[15:8]位  LBAM
+  regs[2] = (sec_no >> 8) & 0xff;
+  sysring_submit(SYS_write_dev, (u_int)&regs[2], MALTA_IDE_LBAM, 1, 0, 0);
+
+  // 设置操作扇区号的[23:16]位  LBAH
+  regs[3] = (sec_no >> 16) & 0xff;
+  sysring_submit(SYS_write_dev, (u_int)&regs[3], MALTA_IDE_LBAH, 1, 0, 0);
+
+  // 设置操作扇区号的[27:24]位，设置扇区寻址模式、磁盘编号
+  regs[4] = ((sec_no >> 24) & 0x0f) | MALTA_IDE_LBA | (disk_no << 4);
+  sysring_submit(SYS_write_dev, (u_int)&regs[4], MALTA_IDE_DEVICE, 1, 0, 0);
+
+  // 设置IDE设备的读写状态
+  regs[5] = cmd;
+  sysring_submit(SYS_write_dev, (u_int)&regs[5], MALTA_IDE_STATUS, 1, 0, 0);
+
+  panic_on(sysring_flush());
+}
+
+/* Overview:
+ *   Transfer 'nsect' sectors between the disk and 'va' by bus master DMA, blocking until the
+ *   transfer completes. Return 0 on success, or -E_NO_SYS if the kernel doesn't support DMA, in
+ *   which case the caller uses PIO.
+ *
+ * Post-Condition:
+ *   Panic if the transfer fails.
+ */
+// 尝试通过 DMA 读写扇区，数据由控制器直接在磁盘与内存之间传输
+static int ide_dma(u_int disk_no, u_int sec_no, void *va, u_int nsect, int to_disk) {
+  int r = syscall_ide_dma(disk_no, sec_no, va, nsect, to_disk);
+  if (r == -E_NO_SYS) {
+    return r;
+  }
+  if (r < 0) {
+    user_panic("ide: dma %s failed: %d", to_disk ? "write" : "read", r);
+  }
+  return 0;
+}
+
 /* Overview:
  *  read data from IDE disk. First issue a read request through
  *  disk register and then copy data from disk buffer
  *  (512 bytes, a sector) to destination array.
+ *  One command reads up to MALTA_IDE_MAX_NSECT sectors; the device requests (DRQ) each of them
+ *  in turn. DMA is used instead of PIO when the kernel supports it.
  *
  * Parameters:
  *  disk_no: disk number.
@@ -47,60 +129,42 @@ void ide_read(u_int disk_no,  // 磁盘号
               void *dst,      // 读取的地址
               u_int seco_num  // 读取n个扇区
   ) {
-  u_int seco_max = seco_num + sec_no;
-  u_int address_offest = 0;
-  uint8_t status_info;
-
   panic_on(disk_no >= 2);
 
-  // 依次读取n个扇区
-  while (sec_no < seco_max) {
-    // 等待IDE设备就绪
-    status_info = wait_ide_ready();
-
-    // 设置操作扇区数目  NSECT
-    status_info = 1;
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_NSECT, 1));
-
-    // 设置操作扇区号的[7:0]位  LBAL
-    status_info = sec_no & 0xff;
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_LBAL, 1));
-
-    // 设置操作扇区号的[15:8]位  IBAM
-    status_info = (sec_no >> 8) & 0xff;
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_LBAM, 1));
-
-    // 设置操作扇区号的[23:16]位  LBAH
-    status_info = (sec_no >> 16) & 0xff;
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_LBAH, 1));
-
-    // 设置操作扇区号的[27:24]位，设置扇区寻址模式、磁盘编号
-    status_info = ((sec_no >> 24) & 0x0f) | MALTA_IDE_LBA | (disk_no << 4);
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_DEVICE, 1));
-
-    // 设置IDE设备为读状态
-    status_info = MALTA_IDE_CMD_PIO_READ;
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_STATUS, 1));
+  // 每条命令读取至多 MALTA_IDE_MAX_NSECT 个扇区
+  while (seco_num > 0) {
+    u_int nsect = MIN(seco_num, MALTA_IDE_MAX_NSECT);
 
     // 等待IDE设备就绪
-    status_info = wait_ide_ready();
-
-    // 循环读取完成整个扇区的数据，每次仅能读取4字节
-    for (int i = 0; i < SECT_SIZE / 4; i++) {
-      panic_on(syscall_read_dev(dst + address_offest + i * 4, MALTA_IDE_DATA, 4));
+    wait_ide_ready();
+    // 优先使用 DMA，内核不支持时使用 PIO
+    if (ide_dma(disk_no, sec_no, dst, nsect, 0) == 0) {
+      dst += nsect * SECT_SIZE;
+      sec_no += nsect;
+      seco_num -= nsect;
+      continue;
     }
+    // 设置扇区号、扇区数、磁盘号，并设置IDE设备为读状态
+    ide_issue(disk_no, sec_no, nsect, MALTA_IDE_CMD_PIO_READ);
 
-    // 检查IDE设备状态
-    panic_on(syscall_read_dev(&status_info, MALTA_IDE_STATUS, 1));
+    for (u_int n = 0; n < nsect; n++) {
+      // 等待设备准备好下一个扇区的数据
+      wait_ide_drq();
 
-    // 进入下一个扇区的读取
-    address_offest += SECT_SIZE;
-    sec_no += 1;
+      // 数据寄存器每次仅能读取4字节，由内核连续读取整个扇区，只需陷入内核一次
+      panic_on(syscall_read_dev_bulk(dst, MALTA_IDE_DATA, 4, SECT_SIZE));
+      dst += SECT_SIZE;
+    }
+
+    sec_no += nsect;
+    seco_num -= nsect;
   }
 }
 
 /* Overview:
  *  write data to IDE disk.
+ *  One command writes up to MALTA_IDE_MAX_NSECT sectors; each sector is written when the device
+ *  requests (DRQ) it. DMA is used instead of PIO when the kernel supports it.
  *
  * Parameters:
  *  disk_no: disk number.
@@ -112,54 +176,42 @@ void ide_read(u_int disk_no,  // 磁盘号
  *  Panic if any error occurs.
  */
 void ide_write(u_int disk_no, u_int sec_no, void *src, u_int seco_num) {
-  u_int seco_max = seco_num + sec_no;
-  u_int address_offest = 0;
   uint8_t status_info;
 
   panic_on(disk_no >= 2);
 
-  // 依次写入扇区
-  while (sec_no < seco_max) {
-    // 等待IDE设备就绪
-    status_info = wait_ide_ready();
-
-    // 设置操作扇区数目
-    status_info = 1;
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_NSECT, 1));
-
-    // 设置操作扇区号的[7:0]位  IBAL
-    status_info = sec_no & 0xff;
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_LBAL, 1));
-
-    // 设置操作扇区号的[15:8]位  IBAM
-    status_info = (sec_no >> 8) & 0xff;
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_LBAM, 1));
+  // 每条命令写入至多 MALTA_IDE_MAX_NSECT 个扇区
+  while (seco_num > 0) {
+    u_int nsect = MIN(seco_num, MALTA_IDE_MAX_NSECT);
 
-    // 设置操作扇区号的[23:16]位  IBAH
-    status_info = (sec_no >> 16) & 0xff;
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_LBAH, 1));
+    // 等待IDE设备就绪
+    wait_ide_ready();
+    // 优先使用 DMA，内核不支持时使用 PIO
+    if (ide_dma(disk_no, sec_no, src, nsect, 1) == 0) {
+      src += nsect * SECT_SIZE;
+      sec_no += nsect;
+      seco_num -= nsect;
+      continue;
+    }
+    // 设置扇区号、扇区数、磁盘号，并设置IDE设备为写状态
+    ide_issue(disk_no, sec_no, nsect, MALTA_IDE_CMD_PIO_WRITE);
 
-    // 设置操作扇区号的[27:24]位，设置扇区寻址模式、磁盘编号
-    status_info = ((sec_no >> 24) & 0x0f) | MALTA_IDE_LBA | (disk_no << 4);
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_DEVICE, 1));
+    for (u_int n = 0; n < nsect; n++) {
+      // 等待设备请求下一个扇区的数据
+      wait_ide_drq();
 
-    // 设置IDE设备为写状态
-    status_info = MALTA_IDE_CMD_PIO_WRITE;
-    panic_on(syscall_write_dev(&status_info, MALTA_IDE_STATUS, 1));
+      // 数据寄存器一次只能写入4个字节，由内核连续写入整个扇区，只需陷入内核一次
+      panic_on(syscall_write_dev_bulk(src, MALTA_IDE_DATA, 4, SECT_SIZE));
+      src += SECT_SIZE;
+    }
 
-    // 等待IDE设备就绪
+    // 等待最后一个扇区写入完成，检查 IDE 设备状态
     status_info = wait_ide_ready();
-
-    // 写入数据，一次只能写入4个字节
-    for (int i = 0; i < SECT_SIZE / 4; i++) {
-      panic_on(syscall_write_dev(src + address_offest + i * 4, MALTA_IDE_DATA, 4));
+    if (status_info & MALTA_IDE_STAT_ERR) {
+      user_panic("ide: write failed, status %02x", status_info);
     }
 
-    // 检查 IDE 设备状态
-    panic_on(syscall_read_dev(&status_info, MALTA_IDE_STATUS, 1));
-
-    // 进入下一个扇区的写入
-    address_offest += SECT_SIZE;
-    sec_no += 1;
+    sec_no += nsect;
+    seco_num -= nsect;
   }
 }
@@ -30,6 +30,11 @@ struct Open {
   int o_mode;
   // 文件描述符的地址，通过地址访问
   struct Filefd *o_ff;
+  // 打开时文件所在的目录，o_file 与 o_dir 所在的磁盘块在文件打开期间常驻内存
+  struct File *o_dir;
+  // 顺序读取时下一个请求应当映射的文件块号，以及当前的预读窗口大小
+  u_int o_ra_next;
+  u_int o_ra_window;
 };
 
 /*
@@ -73,6 +78,25 @@ void serve_init(void) {
   }
 }
 
+// 固定打开文件的文件控制块及其目录所在的磁盘块，文件服务进程在请求之间通过指针访问它们
+static void open_pin(struct Open *open, struct File *file) {
+  open->o_file = file;
+  open->o_dir = file->f_dir;
+  bcache_pin(disk_block_no(file));
+  if (open->o_dir) {
+    bcache_pin(disk_block_no(open->o_dir));
+  }
+}
+
+static void open_unpin(struct Open *open) {
+  bcache_unpin(disk_block_no(open->o_file));
+  if (open->o_dir) {
+    bcache_unpin(disk_block_no(open->o_dir));
+  }
+  open->o_file = NULL;
+  open->o_dir = NULL;
+}
+
 /*
  * Overview:
  *  Allocate an open file.
@@ -98,6 +122,10 @@ int open_alloc(struct Open **open_pointer) {
         // 不break，继续到下面函数进行初始化
       // 只打开一次，曾经被使用过，但现在不被任何用户进程使用的文件，清零后复用
       case 1:
+        // 不再固定原先打开的文件所在的磁盘块
+        if (opentab[i].o_file) {
+          open_unpin(&opentab[i]);
+        }
         // 通过指针返回
         *open_pointer = &opentab[i];
         // 初始化：清零
@@ -151,28 +179,86 @@ int open_lookup(u_int envid, u_int open_id, struct Open **open_pointer) {
  * Functions with the prefix "serve_" are those who
  * conduct the file system requests from clients.
  * The file system receives the requests by function
- * `ipc_recv`, when the requests are received, the
- * file system will call the corresponding `serve_`
- * and return the result to the caller by function
- * `ipc_send`.
+ * `ipc_reply_wait`, when the requests are received, the
+ * file system will call the corresponding `serve_`,
+ * which records the result with `serve_reply`. The result
+ * is returned to the caller by the next `ipc_reply_wait`,
+ * together with waiting for the next request.
  */
 
+/*
+ * The reply to the request being served.
+ * reply_envid is 0 if there is nothing to reply.
+ */
+// 当前请求的回复，在等待下一个请求时一并发出
+static u_int reply_envid;
+static u_int reply_value;
+static struct Ipc_seg reply_segs[IPC_SEG_MAX];
+static u_int reply_nseg;
+
+// 记录对envid的回复：值、共享的页面和页面的权限
+static void serve_reply(u_int envid, u_int value, void *va, u_int perm) {
+  reply_envid = envid;
+  reply_value = value;
+  reply_segs[0].is_va = (u_int)va;
+  reply_segs[0].is_npages = va != NULL;
+  reply_segs[0].is_perm = perm;
+  reply_nseg = 1;
+}
+
+// 记录对envid的回复：值与共享的多个页面片段，片段已经写入reply_segs
+static void serve_reply_segs(u_int envid, u_int value, u_int nseg) {
+  reply_envid = envid;
+  reply_value = value;
+  reply_nseg = nseg;
+}
+
+// Overview:
+//  Send the recorded reply and wait for the next request, like 'ipc_reply_waitv'. A reply that
+//  cannot be delivered (e.g. more pages than the client accepts) is logged and replaced by its
+//  error code without pages; if even that fails, the reply is dropped. A client must not be able
+//  to bring the server down.
+// 发出记录的回复并等待下一个请求，回复无法送达时不会使文件服务进程崩溃
+static u_int serve_reply_wait(u_int *send_id, u_int *permission) {
+  u_int envid = reply_envid;
+  reply_envid = 0;
+
+  int func_info =
+      syscall_ipc_reply_waitv(envid, reply_value, reply_segs, reply_nseg, (void *)REQVA);
+  if (func_info < 0 && envid != 0) {
+    debugf("fs: cannot reply to %08x: %d\n", envid, func_info);
+    // 只回复错误码，客户进程不会一直等待；仍然失败时放弃回复
+    if (syscall_ipc_reply_waitv(envid, func_info, reply_segs, 0, (void *)REQVA) == 0) {
+      func_info = 0;
+    } else {
+      func_info = syscall_ipc_reply_waitv(0, 0, reply_segs, 0, (void *)REQVA);
+    }
+  }
+  if (func_info < 0) {
+    user_panic("syscall_ipc_reply_waitv err: %d", func_info);
+  }
+
+  *send_id = env->env_ipc_from;
+  *permission = env->env_ipc_perm;
+  return env->env_ipc_value;
+}
+
 /*
  * Overview:
  * Serve to open a file specified by the path in `rq`.
  * It will try to alloc an open descriptor, open the file
  * and then save the info in the File descriptor. If everything
- * is done, it will use the ipc_send to return the FileFd page
+ * is done, it will use serve_reply to return the FileFd page
  * to the caller.
  * Parameters:
  * envid: the id of the request process.
  * rq: the request, which contains the path and the open mode.
  * Return:
- * if Success, return the FileFd page to the caller by ipc_send,
- * Otherwise, use ipc_send to return the error value to the caller.
+ * if Success, return the FileFd page to the caller by serve_reply,
+ * Otherwise, use serve_reply to return the error value to the caller.
  */
 // 文件服务进程的打开文件操作
-// 如果出现异常，终止函数，使用ipc_send发送回信息
+// 如果出现异常，终止函数，使用serve_reply记录回复
 void serve_open(u_int envid, struct Fsreq_open *request) {
   struct File *file;
   struct Open *open;
@@ -180,7 +266,7 @@ void serve_open(u_int envid, struct Fsreq_open *request) {
 
   // 申请一个存储文件打开信息的open控制块
   if ((func_info = open_alloc(&open)) < 0) {
-    ipc_send(envid, func_info, 0, 0);
+    serve_reply(envid, func_info, 0, 0);
     return;
   }
 
@@ -190,27 +276,30 @@ void serve_open(u_int envid, struct Fsreq_open *request) {
     func_info = file_create(request->req_path, &file);
     // 如果发生异常  且不是  文件已存在异常
     if(func_info < 0 && func_info != -E_FILE_EXISTS) {
-      ipc_send(envid, func_info, 0, 0);
+      serve_reply(envid, func_info, 0, 0);
       return;
     }
   }
 
   // 使用file_open打开文件
   if ((func_info = file_open(request->req_path, &file)) < 0) {
-    ipc_send(envid, func_info, 0, 0);
+    serve_reply(envid, func_info, 0, 0);
     return;
   }
 
   // 如果是  缩减到0长度  模式
   if (request->req_omode & O_TRUNC) {
     if ((func_info = file_set_size(file, 0)) < 0) {
-      ipc_send(envid, func_info, 0, 0);
+      serve_reply(envid, func_info, 0, 0);
+      return;
     }
   }
 
   // 记录打开信息
-  open->o_file = file;
+  open_pin(open, file);
   open->o_mode = request->req_omode;
+  open->o_ra_next = 0;
+  open->o_ra_window = 0;
   // 填写Filefd内容
   struct Filefd *file_fd = open->o_ff;
   file_fd->f_file = *file;
@@ -219,43 +308,98 @@ void serve_open(u_int envid, struct Fsreq_open *request) {
   // 设置文件描述符对应的设备为devfile
   file_fd->f_fd.fd_dev_id = devfile.dev_id;
 
-  ipc_send(envid, 0, file_fd, PTE_D | PTE_LIBRARY);
+  serve_reply(envid, 0, file_fd, PTE_D | PTE_LIBRARY);
+}
+
+/*
+ * Overview:
+ *  Detect sequential reads of an open file and load the requested blocks of the file together
+ *  with a read-ahead window. The window starts at RA_MIN_BLOCKS when a request continues where
+ *  the previous one ended, doubles on each further sequential request up to RA_MAX_BLOCKS, and
+ *  is dropped on a random access.
+ */
+// 检测顺序读取，将请求的磁盘块与预读窗口中的磁盘块一并读入
+static void open_read_ahead(struct Open *open, u_int file_block_no, u_int nblock) {
+  if (file_block_no == open->o_ra_next) {
+    open->o_ra_window =
+        open->o_ra_window ? MIN(open->o_ra_window * 2, RA_MAX_BLOCKS) : RA_MIN_BLOCKS;
+  } else {
+    open->o_ra_window = 0;
+  }
+  open->o_ra_next = file_block_no + nblock;
+
+  file_read_ahead(open->o_file, file_block_no, nblock + open->o_ra_window);
 }
 
 /*
  * Overview:
  *  Serve to map the file specified by the fileid in `rq`.
  *  It will use the fileid and envid to find the open file and
- *  then call the `file_get_block` to get the block and use
- *  the `ipc_send` to return the block to the caller.
+ *  then call the `file_get_block` to get the blocks. Blocks at
+ *  consecutive addresses are merged into one segment, and the
+ *  blocks in at most IPC_SEG_MAX segments are returned to the
+ *  caller in one reply.
  * Parameters:
  *  envid: the id of the request process.
- *  rq: the request, which contains the fileid and the offset.
+ *  rq: the request, which contains the fileid, the offset and
+ *  the number of blocks.
  * Return:
- *  if Success, use ipc_send to return zero and  the block to
- *  the caller.Otherwise, return the error value to the caller.
+ *  if Success, use serve_reply_segs to return the number of blocks
+ *  and the blocks to the caller. Otherwise, return the error value
+ *  to the caller.
  */
 // 将磁盘块载入内存
 void serve_map(u_int envid, struct Fsreq_map *request) {
   struct Open *open;
   int func_info;
+  u_int nseg = 0, npages = 0;
 
   // 获得对应的open块
   if ((func_info = open_lookup(envid, request->req_fileid, &open)) < 0) {
-    ipc_send(envid, func_info, 0, 0);
+    serve_reply(envid, func_info, 0, 0);
+    return;
+  }
+  if (request->req_npages == 0) {
+    serve_reply(envid, -E_INVAL, 0, 0);
     return;
   }
+  // 回复的页面不能超过客户进程接收回复时声明的页面数，否则回复无法送达
+  u_int npages_max =
+      MIN(request->req_npages, IPC_RECV_NPAGES(envs[ENVX(envid)].env_ipc_dstva));
 
   // 获得磁盘块在文件中的编号f_no
   u_int file_block_no = request->req_offset / BLOCK_SIZE;
-  // 获得磁盘块在磁盘中的编号b_no
-  void *block_no_pointer;
-  if ((func_info = file_get_block(open->o_file, file_block_no, &block_no_pointer)) < 0) {
-    ipc_send(envid, func_info, 0, 0);
-    return;
+  // 为文件中未分配的文件块分配磁盘上连续的磁盘块
+  file_alloc_blocks(open->o_file, file_block_no, npages_max);
+  // 批量读入请求的磁盘块，顺序读取时一并预读之后的磁盘块
+  open_read_ahead(open, file_block_no, npages_max);
+  for (; npages < npages_max; npages++) {
+    // 获得磁盘块在磁盘中的编号b_no
+    void *block_no_pointer;
+    if ((func_info = file_get_block(open->o_file, file_block_no + npages, &block_no_pointer)) < 0) {
+      break;
+    }
+    // 与上一个片段地址连续，合并到其中
+    if (nseg > 0 && reply_segs[nseg - 1].is_va + reply_segs[nseg - 1].is_npages * BLOCK_SIZE ==
+                        (u_int)block_no_pointer) {
+      reply_segs[nseg - 1].is_npages++;
+      continue;
+    }
+    if (nseg == IPC_SEG_MAX) {
+      break;
+    }
+    reply_segs[nseg].is_va = (u_int)block_no_pointer;
+    reply_segs[nseg].is_npages = 1;
+    reply_segs[nseg].is_perm = PTE_D | PTE_LIBRARY;
+    nseg++;
   }
 
-  ipc_send(envid, 0, block_no_pointer, PTE_D | PTE_LIBRARY);
+  // 第一个磁盘块就失败了，返回错误；否则返回已经获得的磁盘块
+  if (npages == 0) {
+    serve_reply(envid, func_info, 0, 0);
+    return;
+  }
+  serve_reply_segs(envid, npages, nseg);
 }
 
 /*
@@ -267,7 +411,7 @@ void serve_map(u_int envid, struct Fsreq_map *request) {
  *  envid: the id of the request process.
  *  rq: the request, which contains the fileid and the size.
  * Return:
- * if Success, use ipc_send to return 0 to the caller. Otherwise,
+ * if Success, use serve_reply to return 0 to the caller. Otherwise,
  * return the error value to the caller.
  */
 // 设置文件的尺寸
@@ -277,17 +421,17 @@ void serve_set_size(u_int envid, struct Fsreq_set_size *request) {
 
   // 获取open块
   if ((func_info = open_lookup(envid, request->req_fileid, &open)) < 0) {
-    ipc_send(envid, func_info, 0, 0);
+    serve_reply(envid, func_info, 0, 0);
     return;
   }
 
   // 设置文件的尺寸
   if ((func_info = file_set_size(open->o_file, request->req_size)) < 0) {
-    ipc_send(envid, func_info, 0, 0);
+    serve_reply(envid, func_info, 0, 0);
     return;
   }
 
-  ipc_send(envid, 0, 0, 0);
+  serve_reply(envid, 0, 0, 0);
 }
 
 /*
@@ -299,7 +443,7 @@ void serve_set_size(u_int envid, struct Fsreq_set_size *request) {
  *  envid: the id of the request process.
  * 	rq: the request, which contains the fileid.
  * Return:
- *  if Success, use ipc_send to return 0 to the caller.Otherwise,
+ *  if Success, use serve_reply to return 0 to the caller.Otherwise,
  *  return the error value to the caller.
  */
 // 关闭文件
@@ -308,41 +452,41 @@ void serve_close(u_int envid, struct Fsreq_close *request) {
   int func_info;
 
   if ((func_info = open_lookup(envid, request->req_fileid, &open)) < 0) {
-    ipc_send(envid, func_info, 0, 0);
+    serve_reply(envid, func_info, 0, 0);
     return;
   }
   // 关闭文件
   file_close(open->o_file);
-  ipc_send(envid, 0, 0, 0);
+  serve_reply(envid, 0, 0, 0);
 }
 
 /*
  * Overview:
  *  Serve to remove a file specified by the path in `req`.
  *  It calls the `file_remove` to remove the file and then use
- *  the `ipc_send` to return the result to the caller.
+ *  `serve_reply` to return the result to the caller.
  * Parameters:
  *  envid: the id of the request process.
  *  rq: the request, which contains the path.
  * Return:
- *  the result of the file_remove to the caller by ipc_send.
+ *  the result of the file_remove to the caller by serve_reply.
  */
 // 移除path处的文件，返回值为移除函数的返回值
 void serve_remove(u_int envid, struct Fsreq_remove *request) {
   int func_info = file_remove(request->req_path);
-  ipc_send(envid, func_info, 0, 0);
+  serve_reply(envid, func_info, 0, 0);
 }
 
 /*
  * Overview:
  *  Serve to dirty the file.
  *  It will use the fileid and envid to find the open file and
- * 	then call the `file_dirty` to dirty the file.
+ * 	then call the `file_dirty` to dirty each block in the range.
  * Parameters:
  *  envid: the id of the request process.
- *  rq: the request, which contains the fileid and the offset.
+ *  rq: the request, which contains the fileid, the offset and the number of blocks.
  * `Return`:
- *  if Success, use ipc_send to return 0 to the caller. Otherwise,
+ *  if Success, use serve_reply to return 0 to the caller. Otherwise,
  *  return the error value to the caller.
  */
 // 将文件控制块标记为脏
@@ -352,29 +496,42 @@ void serve_dirty(u_int envid, struct Fsreq_dirty *request) {
 
   // 获取文件id对应的open块
   if ((func_info = open_lookup(envid, request->req_fileid, &open)) < 0) {
-    ipc_send(envid, func_info, 0, 0);
+    serve_reply(envid, func_info, 0, 0);
     return;
   }
   // 将文件控制块标记为脏
-  if ((func_info = file_dirty(open->o_file, request->req_offset)) < 0) {
-    ipc_send(envid, func_info, 0, 0);
-    return;
+  for (u_int i = 0; i < request->req_npages; i++) {
+    if ((func_info = file_dirty(open->o_file, request->req_offset + i * BLOCK_SIZE)) < 0) {
+      serve_reply(envid, func_info, 0, 0);
+      return;
+    }
   }
 
-  ipc_send(envid, 0, 0, 0);
+  serve_reply(envid, 0, 0, 0);
 }
 
 /*
  * Overview:
  *  Serve to sync the file system.
  *  it calls the `fs_sync` to sync the file system.
- *  and then use the `ipc_send` and `return` 0 to tell the caller
+ *  and then use `serve_reply` to `return` 0 to tell the caller
  *  file system is synced.
  */
 // 将文件系统的文件更新回磁盘
 void serve_sync(u_int envid) {
   fs_sync();
-  ipc_send(envid, 0, 0, 0);
+  serve_reply(envid, 0, 0, 0);
+}
+
+/*
+ * Overview:
+ *  Serve to report the statistics of the block cache.
+ *  The statistics are written back into the request page, which is shared with the caller.
+ */
+// 获取磁盘块缓存的统计信息
+void serve_cache_stat(u_int envid, struct Fsreq_cache_stat *request) {
+  bcache_get_stat(request);
+  serve_reply(envid, 0, 0, 0);
 }
 
 /*
@@ -398,8 +555,25 @@ void *serve_table[MAX_FSREQNO] = {
   [FSREQ_REMOVE]    = serve_remove,
   // 将文件系统的文件更新回磁盘
   [FSREQ_SYNC]      = serve_sync,
+  // 获取磁盘块缓存的统计信息
+  [FSREQ_CACHE_STAT] = serve_cache_stat,
 };
 
+/*
+ * Overview:
+ *  Write back all dirty blocks. The pending reply is sent first, so that the client doesn't wait
+ *  for a write-back unrelated to its request; if it can't be sent, it stays pending for
+ *  'serve_reply_wait'.
+ */
+// 先发出回复，再按块号顺序写回所有脏块
+static void serve_write_back(void) {
+  if (reply_envid != 0 &&
+      syscall_ipc_sendv(reply_envid, reply_value, reply_segs, reply_nseg) == 0) {
+    reply_envid = 0;
+  }
+  fs_sync();
+}
+
 /*
  * Overview:
  *  The main loop of the file system server.
@@ -415,11 +589,19 @@ void serve(void) {
   u_int send_id;
   // 文件服务需要调用的函数
   void (*func)(u_int, u_int);
+  // 上一次写回脏块之后处理的请求数
+  u_int requests_since_sync = 0;
 
   // 通过循环保持持续响应
   for (;;) {
     permission = 0;
-    request = ipc_recv(&send_id, (void *)REQVA, &permission);
+    // 空闲时（没有进程在等待发送请求）先写回脏块再阻塞，写回不会推迟任何请求
+    if (bcache_dirty_count() > 0 && TAILQ_EMPTY(&env->env_ipc_senders)) {
+      serve_write_back();
+      requests_since_sync = 0;
+    }
+    // 发出上一个请求的回复，同时等待下一个请求
+    request = serve_reply_wait(&send_id, &permission);
 
     // All requests must contain an argument page
     // 所有需求必须共享权限为有效
@@ -437,12 +619,20 @@ void serve(void) {
       continue;
     }
 
-    // 调用需求响应函数
+    // 调用需求响应函数，回复由其通过serve_reply记录
+    // 之前的请求访问过的磁盘块此后可以被替换出缓存
+    bcache_next_request();
     func = serve_table[request];
     func(send_id, REQVA);
 
     // Unmap the argument page.
     panic_on(syscall_mem_unmap(0, (void *)REQVA));
+
+    // 有请求在等待时，脏块较多或处理了足够多的请求后才写回
+    if (bcache_dirty_count() >= WB_DIRTY_BLOCKS || ++requests_since_sync >= WB_INTERVAL) {
+      serve_write_back();
+      requests_since_sync = 0;
+    }
   }
 }
 
@@ -19,6 +19,23 @@
 // 磁盘块缓存区域的终止虚拟地址
 #define DISKMAX 0x40000000
 
+/* Maximum number of disk blocks cached in memory at once (4MB) */
+// 磁盘块缓存最多容纳的磁盘块数
+#define BCACHE_NBLOCK 1024
+
+/* Read-ahead window of a sequentially read file, in blocks. The largest window is the most an
+ * IDE command can transfer (256 sectors). */
+// 顺序读取文件时预读窗口的初始大小与最大大小
+#define RA_MIN_BLOCKS 4
+#define RA_MAX_BLOCKS 32
+
+/* The server writes back all dirty blocks when this many blocks are dirty, or after serving
+ * WB_INTERVAL requests, after replying to the request that triggered it. It also writes them back
+ * whenever it is about to block with no sender queued on it. */
+// 触发写回的脏块数与请求数
+#define WB_DIRTY_BLOCKS (BCACHE_NBLOCK / 4)
+#define WB_INTERVAL 64
+
 /* ide.c */
 void ide_read(u_int diskno, u_int secno, void *dst, u_int nsecs);
 void ide_write(u_int diskno, u_int secno, void *src, u_int nsecs);
@@ -27,6 +44,8 @@ void ide_write(u_int diskno, u_int secno, void *src, u_int nsecs);
 int file_open(char *path, struct File **pfile);
 int file_create(char *path, struct File **file);
 int file_get_block(struct File *f, u_int blockno, void **pblk);
+void file_read_ahead(struct File *f, u_int blockno, u_int nblock);
+void file_alloc_blocks(struct File *f, u_int blockno, u_int nblock);
 int file_set_size(struct File *f, u_int newsize);
 void file_close(struct File *f);
 int file_remove(char *path);
@@ -36,5 +55,28 @@ void file_flush(struct File *);
 void fs_init(void);
 void fs_sync(void);
 extern uint32_t *bitmap;
+void *disk_addr(u_int);
+u_int disk_block_no(void *);
 int map_block(u_int);
+void unmap_block(u_int);
 int alloc_block(void);
+int alloc_block_run(u_int nblock);
+void free_block(u_int block_no);
+
+/* bcache.c */
+struct Fsreq_cache_stat;
+void bcache_init(void);
+void bcache_hit(u_int block_no);
+int bcache_miss(u_int block_no);
+int bcache_prefetch(u_int block_no);
+void bcache_set_dirty(u_int block_no);
+void bcache_clear_dirty(u_int block_no);
+u_int bcache_get_dirty(u_int *blocks);
+u_int bcache_dirty_count(void);
+int bcache_insert(u_int block_no);
+void bcache_remove(u_int block_no);
+void bcache_pin(u_int block_no);
+void bcache_unpin(u_int block_no);
+int bcache_defer_free(u_int block_no);
+void bcache_next_request(void);
+void bcache_get_stat(struct Fsreq_cache_stat *stat);
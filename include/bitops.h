@@ -19,4 +19,37 @@
 #define LOG_8(n) (((n) >= 1 << 8) ? (8 + LOG_4((n) >> 8)) : LOG_4(n))
 #define LOG2(n) (((n) >= 1 << 16) ? (16 + LOG_8((n) >> 16)) : LOG_8(n))
 
+/*
+ * Find the first (least significant) set bit in a 32-bit word @x.
+ * Return its position (0 to 31), or -1 if @x is 0. For example
+ * ffs32(0x00000a00) gives us 9.
+ */
+static inline int ffs32(unsigned int x) {
+  int n = 0;
+
+  if (x == 0) {
+    return -1;
+  }
+  if ((x & 0xffff) == 0) {
+    n += 16;
+    x >>= 16;
+  }
+  if ((x & 0xff) == 0) {
+    n += 8;
+    x >>= 8;
+  }
+  if ((x & 0xf) == 0) {
+    n += 4;
+    x >>= 4;
+  }
+  if ((x & 0x3) == 0) {
+    n += 2;
+    x >>= 2;
+  }
+  if ((x & 0x1) == 0) {
+    n += 1;
+  }
+  return n;
+}
+
 #endif
@@ -17,6 +17,43 @@
 #define ENV_RUNNABLE 1
 #define ENV_NOT_RUNNABLE 2
 
+// IPC 共享页面的一个片段：发送方从 is_va 开始的连续 is_npages 个页面，以 is_perm 的权限共享给接收方
+struct Ipc_seg {
+  u_int is_va;
+  u_int is_npages;
+  u_int is_perm;
+};
+
+// 一条消息最多包含的片段数
+#define IPC_SEG_MAX 32
+// 接收地址：收到的页面依次映射到 va 开始的至多 npages 个页面中
+// va 按页对齐，npages - 1 记录在页内偏移中，因此 npages 不超过 PAGE_SIZE
+#define IPC_RECV_VA(va, npages) (ROUNDDOWN((va), PAGE_SIZE) | ((npages)-1))
+// 接收地址中记录的最多接收的页面数
+#define IPC_RECV_NPAGES(dstva) (((dstva) & (PAGE_SIZE - 1)) + 1)
+
+// 阻塞等待向某进程发送消息的进程队列
+TAILQ_HEAD(Env_ipc_wait_list, Env);
+
+// 按需加载的可执行文件中的一个可加载段
+struct Icode_seg {
+  u_int ic_va;     // 段的起始虚拟地址
+  u_int ic_filesz; // 段在文件中的大小
+  u_int ic_memsz;  // 段在内存中的大小
+  u_int ic_offset; // 段在文件中的偏移
+  u_int ic_perm;   // 映射段中页面的权限
+};
+
+// 按需加载的可执行文件：进程第一次访问某个段中的页面时，才从文件内容中填充该页面
+// 由 fork 出的进程共享，引用计数归零时释放对文件页面的引用
+struct Icode_image {
+  u_int im_ref;
+  u_int im_nseg;
+  struct Icode_seg *im_segs;
+  u_int im_npages;
+  struct Page **im_pages; // 文件内容所在的页面，各持有一个引用；不含段的内容的页面为 NULL
+};
+
 // Control block of an environment (process).
 // Env就是PCB，PCB是系统感知进程存在的唯一标志。进程与PCB 是一一对应的。
 struct Env {
@@ -46,8 +83,12 @@ struct Env {
   // 构造调度链表的指针域
   TAILQ_ENTRY(Env) env_sched_link; // intrusive entry in 'env_sched_list'
 
-  // 进程优先级
+  // 进程优先级：决定每一级队列中时间片的长度
   u_int env_pri;
+  // 进程当前所在的调度队列级别（MLFQ），0 为最高
+  u_int env_sched_level;
+  // 进程本次被调度后剩余的时间片数
+  int env_slice_left;
 
   // 用于进程间通信
   // 所有的进程都共享同一个内核空间（主要为kseg0）
@@ -61,15 +102,42 @@ struct Env {
   u_int env_ipc_from;
   // 握手信号：1：等待接受数据中；0：不可接受数据
   u_int env_ipc_recving;
-  // 接收到的页面需要与自身的哪个虚拟页面完成映射
+  // 接收到的页面需要与自身的哪个虚拟页面完成映射，按 IPC_RECV_VA 编码
   u_int env_ipc_dstva;
-  // 接受的页面的权限位设置
+  // 接受的页面的权限位设置（第一个片段的权限）
   u_int env_ipc_perm;
+  // 实际接收到的页面数
+  u_int env_ipc_npages;
+
+  // 阻塞发送：接收方未处于接收态时，发送方在接收方的等待队列中阻塞
+  // 等待向本进程发送消息的进程队列，按到达顺序排列
+  struct Env_ipc_wait_list env_ipc_senders;
+  // 链入接收进程 env_ipc_senders 的指针域
+  TAILQ_ENTRY(Env) env_ipc_send_link;
+  // 正在阻塞等待的接收进程，为 NULL 表示没有在等待发送
+  struct Env *env_ipc_send_to;
+  // 阻塞期间保存的待发送消息：值与共享页面的片段
+  u_int env_ipc_send_value;
+  // 只有一个片段时指向 env_ipc_send_seg，否则指向 kmalloc 得到的副本
+  struct Ipc_seg *env_ipc_send_segs;
+  u_int env_ipc_send_nseg;
+  struct Ipc_seg env_ipc_send_seg;
+  // 阻塞在 sys_ipc_call 中：消息被取走后不唤醒，而是转入接收态等待回复
+  u_int env_ipc_calling;
+
+  // 按需加载的可执行文件，没有时为 NULL
+  struct Icode_image *env_image;
 
   // 存储用户态 TLB Mod异常的处理函数的地址
   // mod: modify，写入异常，对应写入不可写页面时产生该异常
   u_int env_user_tlb_mod_entry;
 
+  // 用户态缺页处理函数（pager）的地址，及其负责的地址区间 [env_pager_va, env_pager_va + env_pager_len)
+  // 用户态访问该区间中未映射的页面时，转入 pager 填充页面
+  u_int env_user_pager_entry;
+  u_int env_pager_va;
+  u_int env_pager_len;
+
   // Lab 6 scheduler counts
   // number of times we've been env_run'ed
   u_int env_runs;
@@ -84,9 +152,15 @@ void env_init(void);
 int env_alloc(struct Env **e, u_int parent_id);
 void env_free(struct Env *);
 struct Env *env_create(const void *binary, size_t size, int priority);
+int env_load_icode(struct Env *env, const void *binary, size_t size, Pde *src_pgdir);
+int env_load_icode_lazy(struct Env *env, const void *binary, size_t size, Pde *src_pgdir);
+int icode_fault(struct Env *env, u_long va);
+struct Page *env_page_lookup(struct Env *env, u_long va, Pte **ppte);
+void icode_image_put(struct Icode_image *image);
 void env_destroy(struct Env *e);
 
 int envid2env(u_int envid, struct Env **penv, int checkperm);
+void env_ipc_release_segs(struct Env *env);
 void env_run(struct Env *e) __attribute__((noreturn));
 
 void env_check(void);
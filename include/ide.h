@@ -0,0 +1,29 @@
+#ifndef _IDE_H_
+#define _IDE_H_
+
+#include <types.h>
+
+// 等待磁盘中断的进程最多阻塞的时钟中断数，超时后被唤醒，重新检查磁盘状态（防止中断丢失）
+#define IDE_WAIT_TIMEOUT_TICKS 4
+
+struct Env;
+
+// 一条 PRD 表项
+struct Ide_prd {
+  u_int prd_addr;   // 物理地址
+  u_short prd_len;  // 字节数，0 表示 64 KB
+  u_short prd_flag; // MALTA_IDE_PRD_EOT 表示最后一项
+};
+
+extern int ide_irq_enabled;
+
+void ide_irq_init(void);
+void ide_dma_init(void);
+int ide_dma_start(struct Env *env, u_int disk_no, u_int sec_no, u_long va, u_int nsect,
+                  int to_disk);
+void do_irq_i8259(void);
+int ide_wait(struct Env *env);
+void ide_idle(void);
+void ide_tick(void);
+
+#endif /* _IDE_H_ */
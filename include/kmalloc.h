@@ -0,0 +1,50 @@
+#ifndef _KMALLOC_H_
+#define _KMALLOC_H_
+
+#include <queue.h>
+#include <types.h>
+
+// slab 分配器：每个 slab 占用一个物理页，页首为 struct Slab，其后为等长的对象
+LIST_HEAD(Slab_list, Slab);
+
+struct Slab {
+  LIST_ENTRY(Slab) sl_link;   // 链入所属 cache 的 full/partial/free 链表
+  struct kmem_cache *sl_cache; // 所属的 cache
+  void *sl_free;              // 空闲对象链表，通过对象的首个字链接
+  u_int sl_inuse;             // 已分配出去的对象数量
+};
+
+// 一个 cache 管理同一大小的对象，释放的对象回到其所在的 slab 中，供后续分配复用
+struct kmem_cache {
+  const char *kc_name;
+  u_int kc_size;               // 对象大小（按 8 字节对齐）
+  u_int kc_objs;               // 每个 slab 中的对象数量，首次分配时计算
+  struct Slab_list kc_full;    // 对象全部分配出去的 slab
+  struct Slab_list kc_partial; // 部分对象已分配的 slab
+  struct Slab_list kc_free;    // 对象全部空闲的 slab
+  u_int kc_nfree;              // kc_free 中 slab 的数量
+  u_int kc_nalloc;             // 已分配出去的对象数量
+};
+
+// 静态定义一个 cache，无需额外的初始化调用
+#define KMEM_CACHE_INITIALIZER(name, size)                                                   \
+  { (name), ROUND((size), 8), 0, {NULL}, {NULL}, {NULL}, 0, 0 }
+
+// kmalloc 的最小与最大的 slab 对象大小，超过最大值的请求直接按页分配
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MAX_SHIFT 10
+#define KMALLOC_MAX_SIZE (1 << KMALLOC_MAX_SHIFT)
+
+// 每个 cache 最多保留的全空闲 slab 数量，多余的页归还给页分配器
+#define KMEM_CACHE_KEEP_FREE 1
+
+void kmem_cache_init(struct kmem_cache *cache, const char *name, u_int size);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+void *kmalloc(size_t size);
+void kfree(void *ptr);
+
+void kmalloc_check(void);
+
+#endif /* _KMALLOC_H_ */
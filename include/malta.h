@@ -49,6 +49,13 @@
 
 #define MALTA_IDE_LBA 0xE0
 #define MALTA_IDE_BUSY 0x80
+// 状态：设备已准备好传输一个扇区的数据（Data Request）
+#define MALTA_IDE_DRQ 0x08
+// 状态：上一条命令出错，错误原因见 MALTA_IDE_ERR
+#define MALTA_IDE_STAT_ERR 0x01
+
+// 一条读写命令最多操作的扇区数，NSECT 为 0 时表示 256 个扇区
+#define MALTA_IDE_MAX_NSECT 256
 
 // IDE设备为读状态
 #define MALTA_IDE_CMD_PIO_READ 0x20  /* Read sectors with retry */
@@ -56,6 +63,67 @@
 // IDE设备为写状态
 #define MALTA_IDE_CMD_PIO_WRITE 0x30 /* write sectors with retry */
 
+// IDE设备以 DMA 方式读、写扇区（28 位 LBA）
+#define MALTA_IDE_CMD_DMA_READ 0xc8
+#define MALTA_IDE_CMD_DMA_WRITE 0xca
+
+/*
+ * PIIX4 IDE bus master (DMA) interface of the primary channel, at the I/O base in BAR4 of the
+ * IDE function. The PRD (Physical Region Descriptor) table lists the physical memory regions of
+ * a transfer.
+ */
+// 命令寄存器：启动/停止传输，以及传输方向
+#define MALTA_IDE_BM_CMD 0x0
+#define MALTA_IDE_BM_CMD_START 0x01
+#define MALTA_IDE_BM_CMD_TO_MEMORY 0x08
+// 状态寄存器：传输中、出错、设备已发出中断，后两位写 1 清除
+#define MALTA_IDE_BM_STATUS 0x2
+#define MALTA_IDE_BM_STATUS_ACTIVE 0x01
+#define MALTA_IDE_BM_STATUS_ERR 0x02
+#define MALTA_IDE_BM_STATUS_IRQ 0x04
+// PRD 表的物理地址
+#define MALTA_IDE_BM_PRDT 0x4
+// PRD 表项：最后一项的标志，以及一项最多描述的字节数（不能跨越 64 KB 边界）
+#define MALTA_IDE_PRD_EOT 0x8000
+#define MALTA_IDE_PRD_MAX 0x10000
+// BAR4 未被分配时使用的 I/O 基址
+#define MALTA_IDE_BM_DEFAULT_BASE 0xc000
+
+/*
+ * GT-64120 system controller: PCI configuration space access of the PCI bus.
+ */
+#define MALTA_GT_BASE 0x1be00000
+#define MALTA_GT_PCI_CFGADDR (MALTA_GT_BASE + 0xcf8)
+#define MALTA_GT_PCI_CFGDATA (MALTA_GT_BASE + 0xcfc)
+#define MALTA_PCI_CFG_ENABLE 0x80000000
+#define MALTA_PCI_CFG_ADDR(dev, func, reg) \
+	(MALTA_PCI_CFG_ENABLE | ((dev) << 11) | ((func) << 8) | ((reg) & 0xfc))
+// PIIX4 的 IDE 功能所在的设备号与功能号
+#define MALTA_PIIX4_DEV 10
+#define MALTA_PIIX4_IDE_FUNC 1
+// PCI 配置空间寄存器：命令（I/O 空间使能、总线主控使能），以及 BAR4
+#define MALTA_PCI_COMMAND 0x04
+#define MALTA_PCI_COMMAND_IO 0x1
+#define MALTA_PCI_COMMAND_MASTER 0x4
+#define MALTA_PCI_BAR4 0x20
+
+/*
+ * Intel 8259A programmable interrupt controllers of the PIIX4, the slave cascaded on IRQ2 of
+ * the master, whose output is the CPU hardware interrupt 0 (Cause.IP2).
+ */
+#define MALTA_I8259_MASTER_CMD (MALTA_PCIIO_BASE + 0x20)
+#define MALTA_I8259_MASTER_DATA (MALTA_PCIIO_BASE + 0x21)
+#define MALTA_I8259_SLAVE_CMD (MALTA_PCIIO_BASE + 0xa0)
+#define MALTA_I8259_SLAVE_DATA (MALTA_PCIIO_BASE + 0xa1)
+// OCW2：结束中断（End Of Interrupt）
+#define MALTA_I8259_EOI 0x20
+// OCW3：查询命令，随后读取命令端口得到正在请求的中断号
+#define MALTA_I8259_POLL 0x0c
+
+// 从片级联的中断号，以及主 IDE 通道的中断号
+#define MALTA_IRQ_CASCADE 2
+#define MALTA_IRQ_IDE 14
+
 /*
  * MALTA Power Management device definitions.
  */
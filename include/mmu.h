@@ -6,6 +6,8 @@
  */
 // 支持的ASID总数
 #define NASID 256
+// 4Kc 的 TLB 表项数量
+#define NTLB 16
 // PAGE_SIZE 为 页 对应的字节大小
 #define PAGE_SIZE 4096
 // 每个页表项映射的字节数：和页大小相同
@@ -226,6 +228,8 @@ typedef u_long Pte;
   })
 
 extern void tlb_out(u_int entryhi);
+extern void tlb_flush_all(void);
+extern void do_tlb_refill(void);
 void tlb_invalidate(u_int asid, u_long va);
 #endif //!__ASSEMBLER__
 #endif // !_MMU_H_
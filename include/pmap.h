@@ -25,10 +25,40 @@ struct Page {
 
   // 有多少个物理页对应该虚拟页
   u_short pp_ref;
+
+  // 伙伴系统使用：该页作为块首时所在块的阶数（块大小为 2^pp_order 页）
+  u_char pp_order;
+  // 页的状态标志，见下方 PAGE_* 定义
+  u_char pp_flags;
 };
 
+// 页位于伙伴系统的空闲链表中，且为一个空闲块的首页
+#define PAGE_BUDDY_FREE 0x1
+// 页被 kmalloc 用作 slab
+#define PAGE_SLAB 0x2
+// 页（或以其为首的连续块）由 kmalloc 直接分配给大对象
+#define PAGE_KMALLOC 0x4
+
+// 预清零页池的容量上限，以及每次空闲时补充的页数
+#define PAGE_ZERO_POOL_MAX 128
+#define PAGE_ZERO_REFILL_BATCH 8
+
+// 伙伴系统管理的最大阶数：最大块为 2^BUDDY_MAX_ORDER 页（4 MB）
+#define BUDDY_MAX_ORDER 10
+// 物理内存中划给伙伴系统的比例：最高的 1/BUDDY_ZONE_RATIO 的页
+#define BUDDY_ZONE_RATIO 8
+
 extern struct Page *pages;
 extern struct Page_list page_free_list;
+extern u_long buddy_start;
+
+// 预清零页池的统计：命中（直接取到已清零页）、未命中（同步清零）、后台清零的页数
+struct Page_zero_stat {
+  u_int hit;
+  u_int miss;
+  u_int refill;
+};
+extern struct Page_zero_stat page_zero_stat;
 
 // 通过指针减法，得到对应的控制块是第几个页
 static inline u_long page2ppn(struct Page *page_pointer) {
@@ -76,15 +106,25 @@ void page_init(void);
 void *alloc(u_int n, u_int align, int clear);
 
 int page_alloc(struct Page **pp);
+int page_alloc_nozero(struct Page **pp);
+void page_zero_refill(u_int max);
+void page_zero_report(void);
 void page_free(struct Page *pp);
 void page_decref(struct Page *pp);
 int page_insert(Pde *pgdir, u_int asid, struct Page *pp, u_long va, u_int perm);
 struct Page *page_lookup(Pde *pgdir, u_long va, Pte **ppte);
-void page_remove(Pde *pgdir, u_int asid, u_long va);
+int page_remove(Pde *pgdir, u_int asid, u_long va);
+int pgtable_unshare(Pde *pgdir, u_int asid, u_long va);
+
+int pages_alloc(struct Page **pp, u_int order);
+void pages_free(struct Page *pp, u_int order);
+void buddy_steal(struct Page_list *area);
+void buddy_restore(struct Page_list *area);
 
 extern struct Page *pages;
 
 void physical_memory_manage_check(void);
 void page_check(void);
+void buddy_check(void);
 
 #endif /* _PMAP_H_ */
@@ -1,6 +1,15 @@
 #ifndef __SCHED_H__
 #define __SCHED_H__
 
+// 多级反馈队列（MLFQ）调度的参数
+// 优先级队列的级数，第 0 级优先级最高
+#define MLFQ_NLEVEL 4
+// 每经过多少个时钟中断，将所有就绪进程提升回第 0 级，避免低优先级进程饥饿
+#define MLFQ_BOOST_TICKS 100
+
 void schedule(int yield) __attribute__((noreturn));
 
+struct Env;
+void schedule_handoff(struct Env *next) __attribute__((noreturn));
+
 #endif /* __SCHED_H__ */
@@ -24,9 +24,38 @@ enum {
 	SYS_cgetc,
 	SYS_write_dev,
 	SYS_read_dev,
+	SYS_ipc_send,
+	SYS_ipc_call,
+	SYS_ipc_reply_wait,
+	SYS_ipc_sendv,
+	SYS_ipc_reply_waitv,
+	SYS_sysring_enter,
+	SYS_fork,
+	SYS_spawn,
+	SYS_set_pager,
+	SYS_write_dev_bulk,
+	SYS_read_dev_bulk,
+	SYS_ide_wait,
+	SYS_ide_dma,
 	MAX_SYSNO,
 };
 
+// 批量系统调用的环形队列：用户进程依次填入系统调用，通过一次 SYS_sysring_enter 陷入内核全部执行
+// 队列占据一个页面，仅 mem_alloc、mem_map、mem_unmap 与设备读写的系统调用可以批量执行
+#define SYSRING_NENT 128
+
+struct Sysring_entry {
+	u_int se_sysno;   // 系统调用号
+	u_int se_args[5]; // 系统调用的参数
+	int se_ret;       // 执行完成后由内核填入返回值
+};
+
+struct Sysring {
+	u_int sr_head; // 内核已经执行到的位置，由内核推进
+	u_int sr_tail; // 用户已经提交到的位置，由用户推进
+	struct Sysring_entry sr_ent[SYSRING_NENT];
+};
+
 #endif
 
 #endif
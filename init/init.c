@@ -1,5 +1,6 @@
 #include <asm/asm.h>
 #include <env.h>
+#include <ide.h>
 #include <pmap.h>
 #include <printk.h>
 #include <sched.h>
@@ -52,6 +53,11 @@ void mips_init(u_int argc, char **argv, char **penv, u_int ram_low_size) {
   // 并创建模板页目录，方便后续使用
   env_init();
 
+  // 初始化中断控制器，文件服务进程可以等待磁盘中断而不必轮询
+  // 并启用磁盘的 DMA 传输
+  ide_irq_init();
+  ide_dma_init();
+
   // 在内核初始化时设置两个进程，并开始运行（创建即运行）
   ENV_CREATE_PRIORITY(user_bare_loop, 1);
   ENV_CREATE_PRIORITY(user_bare_loop, 2);
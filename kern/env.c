@@ -1,6 +1,8 @@
 #include <asm/cp0regdef.h>
 #include <elf.h>
 #include <env.h>
+#include <ide.h>
+#include <kmalloc.h>
 #include <mmu.h>
 #include <pmap.h>
 #include <printk.h>
@@ -24,19 +26,48 @@ static Pde *base_pgdir;
 
 // 管理ASID的位图
 static uint32_t asid_bitmap[NASID / 32] = {0};
+
+// ASID 的代数（generation）：env_asid 的低 8 位为硬件 ASID，高位为分配该 ASID 时的代数
+// 当位图中的 ASID 用尽时，代数增加、位图清空并刷新整个 TLB，此前分配的 ASID 全部过期
+// 进程在 env_run 时才检查自己的 ASID 是否过期，过期则重新分配
+// 代数从 NASID 开始，env_asid 为 0 表示尚未分配 ASID
+static u_int asid_generation = NASID;
+
+// 获取 env_asid 中的代数部分
+#define ASID_GEN(asid) ((asid) & ~(NASID - 1))
+
+/* Overview:
+ *  Allocate an ASID of the current generation for 'env'. If all ASIDs of the current generation
+ *  are in use, start a new generation: every ASID handed out before becomes stale, so the whole
+ *  TLB is flushed once. Envs holding stale ASIDs get new ones the next time they are run.
+ *
+ * Post-Condition:
+ *  'env->env_asid' is set, this never fails.
+ */
 // 创建一个asid
-// asid使用位图法进行管理，是有限的
-static int asid_alloc(u_int *asid) {
-  for (u_int i = 0; i < NASID; ++i) {
-    int index = i >> 5;
-    int inner = i & 31;
-    if ((asid_bitmap[index] & (1 << inner)) == 0) {
-      asid_bitmap[index] |= 1 << inner;
-      *asid = i;
-      return 0;
+// asid使用位图法进行管理，是有限的，用尽时通过增加代数回收
+static void asid_alloc(struct Env *env) {
+  for (int round = 0; round < 2; round++) {
+    for (u_int i = 0; i < NASID; ++i) {
+      int index = i >> 5;
+      int inner = i & 31;
+      if ((asid_bitmap[index] & (1 << inner)) == 0) {
+        asid_bitmap[index] |= 1 << inner;
+        env->env_asid = asid_generation | i;
+        return;
+      }
     }
+
+    // 本代的 ASID 已经用尽，开始新的一代
+    asid_generation += NASID;
+    // 代数回绕时跳过 0，0 代表未分配
+    if (asid_generation == 0) {
+      asid_generation = NASID;
+    }
+    memset(asid_bitmap, 0, sizeof(asid_bitmap));
+    tlb_flush_all();
   }
-  return -E_NO_FREE_ENV;
+  panic("asid_alloc: no asid after rollover");
 }
 
 /* Overview:
@@ -46,9 +77,14 @@ static int asid_alloc(u_int *asid) {
  *  The ASID is allocated by 'asid_alloc'.
  *
  * Post-Condition:
- *  The ASID is freed and may be allocated again later.
+ *  The ASID is freed and may be allocated again later. ASIDs of an old generation are already
+ *  free in the current bitmap and are ignored.
  */
-static void asid_free(u_int i) {
+static void asid_free(u_int asid) {
+  if (asid == 0 || ASID_GEN(asid) != asid_generation) {
+    return;
+  }
+  u_int i = asid & (NASID - 1);
   int index = i >> 5;
   int inner = i & 31;
   asid_bitmap[index] &= ~(1 << inner);
@@ -219,7 +255,8 @@ static int env_setup_vm(struct Env *env) {
  *
  * Post-Condition:
  *   return 0 on success, and basic fields of the new Env are set up.
- *   return < 0 on error, if no free env, no free asid, or 'env_setup_vm' failed.
+ *   return < 0 on error, if no free env or 'env_setup_vm' failed.
+ *   The ASID is assigned lazily by 'env_run', so running out of ASIDs never makes this fail.
  *
  * Hints:
  *   You may need to use these functions or macros:
@@ -253,15 +290,24 @@ int env_alloc(struct Env **new, u_int parent_id) {
    *   'env_parent_id' (lab3)
    */
   env->env_user_tlb_mod_entry = 0;  // for lab4
+  env->env_user_pager_entry = 0;
+  env->env_pager_va = 0;
+  env->env_pager_len = 0;
   env->env_runs = 0;	              // for lab6
+  // 新进程从最高优先级的队列开始，时间片在第一次被调度时分配
+  env->env_sched_level = 0;
+  env->env_slice_left = 0;
+  // 没有等待发送的进程，也没有在等待发送
+  TAILQ_INIT(&env->env_ipc_senders);
+  env->env_ipc_send_to = NULL;
+  env->env_ipc_calling = 0;
+  env->env_image = NULL;
   // 设置进程的id
   env->env_id = mkenvid(env);
   // 设置进程的父进程id
   env->env_parent_id = parent_id;
-  // 设置进程的asid
-  if ((func_info = asid_alloc(&env->env_asid)) != 0) {
-    return func_info;
-  }
+  // 进程的asid在第一次运行时由 env_run 分配
+  env->env_asid = 0;
 
   // 设置进程相关的属性
   /* Step 4: Initialize the sp and 'cp0_status' in 'e->env_tf'.
@@ -275,6 +321,12 @@ int env_alloc(struct Env **new, u_int parent_id) {
   // - 其它所有情况下，处理器均处于内核模式下
   // - 栈寄存器是第29号寄存器，是用户栈，不是内核栈
   env->env_tf.cp0_status = STATUS_IM7 | STATUS_IE | STATUS_EXL | STATUS_UM;
+#if !defined(LAB) || LAB >= 5
+  // 初始化了中断控制器时，进程运行时也接受磁盘中断
+  if (ide_irq_enabled) {
+    env->env_tf.cp0_status |= STATUS_IM2;
+  }
+#endif
   // Reserve space for 'argc' and 'argv'.
   env->env_tf.regs[29] = USTACKTOP - sizeof(int) - sizeof(char **);
 
@@ -292,8 +344,14 @@ int env_alloc(struct Env **new, u_int parent_id) {
  * Pre-Condition:
  *   'offset + len' is not larger than 'PAGE_SIZE'.
  *
+ *   If the image is mapped in a user address space ('src_pgdir' of the loader), a read-only page
+ *   fully covered by 'src' at a page-aligned address is not copied: the page backing 'src' is
+ *   mapped into the env instead, so all envs running the same file share one physical copy.
+ *   This relies on the file server never reusing a cache page that is still shared: a freed
+ *   block is dropped from the cache (see 'free_block' in fs/fs.c).
+ *
  * Hint:
- *   The address of env structure is passed through 'data' from 'elf_load_seg', where this function
+ *   The 'struct Icode_loader' is passed through 'data' from 'elf_load_seg', where this function
  *   works as a callback.
  *
  * Note:
@@ -304,18 +362,40 @@ int env_alloc(struct Env **new, u_int parent_id) {
  */
 // 用于完成单个页面的加载过程
 // src和len代表相应需要拷贝的数据，拷贝到距离offest的地方，可为空
-static int load_icode_mapper(void *env_data,  // 需要加载的进程控制块
+// 加载可执行文件时传递给 load_icode_mapper 的参数
+struct Icode_loader {
+  struct Env *env; // 需要加载的进程控制块
+  Pde *src_pgdir;  // 可执行文件映射所在的用户地址空间，文件位于内核中时为 NULL
+};
+
+static int load_icode_mapper(void *loader_data, // 加载参数
                             u_long virtual_address, // 需要加载到的目的地虚拟地址
                             size_t offset,    // 偏移量，对齐后设置为0
                             u_int permission, // 加载到内存后数据的权限
                             const void *src,  // 需要加载的数据的虚拟地址
                             size_t len) {     // 需要加载的数据的长度
   int func_info;
-  // 将 data 还原为进程控制块
-  struct Env *env = (struct Env *)env_data;
-  // 将数据加载到内存，需要先申请页面
+  struct Icode_loader *loader = (struct Icode_loader *)loader_data;
+  struct Env *env = loader->env;
   struct Page *page;
-  if((func_info = page_alloc(&page)) != 0) {
+
+  // 只读的整页直接共享文件所在的物理页面，不设置 PTE_D，无需复制
+  if (loader->src_pgdir != NULL && src != NULL && offset == 0 && len == PAGE_SIZE &&
+      !(permission & PTE_D) && ((u_long)src & (PAGE_SIZE - 1)) == 0) {
+    page = page_lookup(loader->src_pgdir, (u_long)src, NULL);
+    if (page != NULL) {
+      return page_insert(env->env_pgdir, env->env_asid, page, virtual_address, permission);
+    }
+  }
+
+  // 将数据加载到内存，需要先申请页面
+  // 整页都会被数据覆盖时无需预先清零
+  if (src != NULL && offset == 0 && len == PAGE_SIZE) {
+    func_info = page_alloc_nozero(&page);
+  } else {
+    func_info = page_alloc(&page);
+  }
+  if (func_info != 0) {
     return func_info;
   }
 
@@ -329,21 +409,66 @@ static int load_icode_mapper(void *env_data,  // 需要加载的进程控制块
 }
 
 /* Overview:
- *   Load program segments from 'binary' into user space of the env 'e'.
- *   'binary' points to an ELF executable image of 'size' bytes, which contains both text and data
- *   segments.
+ *   Check that 'binary' of 'size' bytes is an ELF executable whose program headers and loadable
+ *   segments lie inside 'binary', with the segments mapped below the user stack, so that an image
+ *   coming from user space (see 'sys_spawn') can be loaded safely.
+ *
+ * Post-Condition:
+ *   Return the ELF header of 'binary', or NULL if it is not a valid executable.
  */
-// 加载可执行文件binary到进程env的内存中
-static void load_icode(struct Env *env, const void *binary, size_t size) {
+// 检查ELF文件的程序头表与各个可加载段是否合法
+static const Elf32_Ehdr *icode_check(const void *binary, size_t size) {
   // 解析地址对应的文件是否为ELF类型，若是获取其节头表指针
   const Elf32_Ehdr *elf_head = elf_from(binary, size);
-  if (elf_head==NULL) {
-    panic("bad elf at %x", binary);
+  if (elf_head == NULL) {
+    return NULL;
+  }
+  // 程序头表需要完整地位于文件中
+  if (elf_head->e_phentsize < sizeof(Elf32_Phdr) || elf_head->e_phoff > size ||
+      (size - elf_head->e_phoff) / elf_head->e_phentsize < elf_head->e_phnum) {
+    return NULL;
+  }
+
+  size_t segment_off;
+  ELF_FOREACH_PHDR_OFF (segment_off, elf_head) {
+    Elf32_Phdr *segment_pointer = (Elf32_Phdr *)(binary + segment_off);
+    // 段的内容需要位于文件中，段需要位于用户栈之下
+    if (segment_pointer->p_type == PT_LOAD &&
+        (segment_pointer->p_offset > size ||
+         size - segment_pointer->p_offset < segment_pointer->p_filesz ||
+         segment_pointer->p_filesz > segment_pointer->p_memsz ||
+         segment_pointer->p_vaddr < UTEMP + PAGE_SIZE ||
+         segment_pointer->p_vaddr > USTACKTOP - PAGE_SIZE ||
+         USTACKTOP - PAGE_SIZE - segment_pointer->p_vaddr < segment_pointer->p_memsz)) {
+      return NULL;
+    }
+  }
+  return elf_head;
+}
+
+/* Overview:
+ *   Load the ELF executable 'binary' of 'size' bytes into the address space of 'env', and set
+ *   its entry point as the 'cp0_epc' of 'env'.
+ *   'src_pgdir' is the page directory 'binary' is mapped in if it is a user address, whose
+ *   read-only pages may then be shared with 'env', or NULL if 'binary' is in kernel space.
+ *
+ * Post-Condition:
+ *   Return 0 on success, -E_NOT_EXEC if 'binary' is not a valid executable (see 'icode_check'), or
+ *   the original error if underlying calls fail. The pages loaded so far are left in 'env' on
+ *   failure.
+ */
+// 将内存中的ELF文件加载到进程中，出错时返回错误码
+int env_load_icode(struct Env *env, const void *binary, size_t size, Pde *src_pgdir) {
+  const Elf32_Ehdr *elf_head = icode_check(binary, size);
+  if (elf_head == NULL) {
+    return -E_NOT_EXEC;
   }
 
   /* Step 2: Load the segments using 'ELF_FOREACH_PHDR_OFF' and 'elf_load_seg'.
    * As a loader, we just care about loadable segments, so parse only program headers here.
    */
+  struct Icode_loader loader = {env, src_pgdir};
+
   // 程序头表所在处与文件头的偏移量
   size_t segment_off;
   ELF_FOREACH_PHDR_OFF (segment_off, elf_head) {
@@ -352,13 +477,210 @@ static void load_icode(struct Env *env, const void *binary, size_t size) {
     if (segment_pointer->p_type == PT_LOAD) {
       // 将一个段加载到内存中
       // load_icode_mapper用于完成单个页面的加载过程
-      panic_on(elf_load_seg(segment_pointer, binary + segment_pointer->p_offset, load_icode_mapper, env));
+      try(elf_load_seg(segment_pointer, binary + segment_pointer->p_offset, load_icode_mapper,
+                       &loader));
     }
   }
 
   // 将进程控制块中trap frame的epc cp0寄存器的值设置为ELF文件中设定的程序入口地址
   // 指示了进程恢复运行时PC应恢复到的位置
   env->env_tf.cp0_epc = elf_head->e_entry;
+  return 0;
+}
+
+/* Overview:
+ *   Like 'env_load_icode', but load no page now: record the loadable segments of 'binary' and
+ *   references to the pages backing their file content in 'src_pgdir' as the 'env_image' of
+ *   'env', and let 'icode_fault' fill each page of the segments on its first access. Pages of
+ *   'binary' holding nothing loadable (symbols, debug info) are not referenced.
+ *
+ * Pre-Condition:
+ *   'binary' is page-aligned.
+ *
+ * Post-Condition:
+ *   Return 0 on success, -E_NOT_EXEC if 'binary' is not a valid executable, -E_INVAL if a page
+ *   holding the content of a segment is not mapped in 'src_pgdir', or -E_NO_MEM if we're out of
+ *   memory.
+ */
+// 按需加载可执行文件：只记录各个段与文件页面，页面在第一次访问时才被填充
+int env_load_icode_lazy(struct Env *env, const void *binary, size_t size, Pde *src_pgdir) {
+  const Elf32_Ehdr *elf_head = icode_check(binary, size);
+  if (elf_head == NULL) {
+    return -E_NOT_EXEC;
+  }
+
+  u_int nseg = 0;
+  u_int npages = ROUND(size, PAGE_SIZE) / PAGE_SIZE;
+  size_t segment_off;
+  ELF_FOREACH_PHDR_OFF (segment_off, elf_head) {
+    if (((Elf32_Phdr *)(binary + segment_off))->p_type == PT_LOAD) {
+      nseg++;
+    }
+  }
+
+  // 段描述与页面数组紧随结构体之后，一次分配
+  struct Icode_image *image = kmalloc(sizeof(struct Icode_image) + nseg * sizeof(struct Icode_seg) +
+                                      npages * sizeof(struct Page *));
+  if (image == NULL) {
+    return -E_NO_MEM;
+  }
+  image->im_ref = 1;
+  image->im_nseg = 0;
+  image->im_segs = (struct Icode_seg *)(image + 1);
+  image->im_npages = npages;
+  image->im_pages = (struct Page **)(image->im_segs + nseg);
+
+  ELF_FOREACH_PHDR_OFF (segment_off, elf_head) {
+    Elf32_Phdr *segment_pointer = (Elf32_Phdr *)(binary + segment_off);
+    if (segment_pointer->p_type == PT_LOAD) {
+      struct Icode_seg *seg = &image->im_segs[image->im_nseg++];
+      seg->ic_va = segment_pointer->p_vaddr;
+      seg->ic_filesz = segment_pointer->p_filesz;
+      seg->ic_memsz = segment_pointer->p_memsz;
+      seg->ic_offset = segment_pointer->p_offset;
+      // 与 elf_load_seg 相同：可写的段才设置 PTE_D
+      seg->ic_perm = PTE_V | ((segment_pointer->p_flags & PF_W) ? PTE_D : 0);
+    }
+  }
+  // 只记录含有段的文件内容的页面，其余页面（符号表、调试信息等）为 NULL
+  for (u_int i = 0; i < npages; i++) {
+    image->im_pages[i] = NULL;
+    for (u_int j = 0; j < image->im_nseg; j++) {
+      struct Icode_seg *seg = &image->im_segs[j];
+      if (i * PAGE_SIZE < seg->ic_offset + seg->ic_filesz &&
+          (i + 1) * PAGE_SIZE > seg->ic_offset) {
+        image->im_pages[i] = page_lookup(src_pgdir, (u_long)binary + i * PAGE_SIZE, NULL);
+        if (image->im_pages[i] == NULL) {
+          kfree(image);
+          return -E_INVAL;
+        }
+        break;
+      }
+    }
+  }
+  // 持有文件页面的引用，调用者关闭文件后页面仍然有效
+  for (u_int i = 0; i < npages; i++) {
+    if (image->im_pages[i] != NULL) {
+      image->im_pages[i]->pp_ref++;
+    }
+  }
+
+  icode_image_put(env->env_image);
+  env->env_image = image;
+  env->env_tf.cp0_epc = elf_head->e_entry;
+  return 0;
+}
+
+// 释放对按需加载的可执行文件的一个引用，最后一个引用释放时归还文件页面
+void icode_image_put(struct Icode_image *image) {
+  if (image == NULL || --image->im_ref > 0) {
+    return;
+  }
+  for (u_int i = 0; i < image->im_npages; i++) {
+    if (image->im_pages[i] != NULL) {
+      page_decref(image->im_pages[i]);
+    }
+  }
+  kfree(image);
+}
+
+// 将文件中从 offset 开始的 len 字节复制到 dst
+static void icode_copy(struct Icode_image *image, void *dst, u_int offset, u_int len) {
+  while (len > 0) {
+    u_int n = MIN(len, PAGE_SIZE - offset % PAGE_SIZE);
+    memcpy(dst, (void *)(page2kva(image->im_pages[offset / PAGE_SIZE]) + offset % PAGE_SIZE), n);
+    dst += n;
+    offset += n;
+    len -= n;
+  }
+}
+
+/* Overview:
+ *   Fill the page at 'va' of 'env' from its 'env_image', if 'va' is in one of its segments.
+ *   A read-only page covered by the file content of a single segment at a page-aligned file
+ *   offset maps the file page itself; other pages get a private copy, zero-filled beyond the file
+ *   content of the segments.
+ *
+ * Post-Condition:
+ *   Return 0 on success, -E_INVAL if 'va' is not in a segment of 'env_image', or the original
+ *   error if underlying calls fail.
+ */
+// 在缺页时按需填充可执行文件中的页面
+int icode_fault(struct Env *env, u_long va) {
+  struct Icode_image *image = env->env_image;
+  if (image == NULL) {
+    return -E_INVAL;
+  }
+
+  u_long page_va = ROUNDDOWN(va, PAGE_SIZE);
+  u_int perm = 0, nseg = 0;
+  struct Icode_seg *seg = NULL;
+  for (u_int i = 0; i < image->im_nseg; i++) {
+    struct Icode_seg *s = &image->im_segs[i];
+    if (page_va + PAGE_SIZE > s->ic_va && page_va < s->ic_va + s->ic_memsz) {
+      perm |= s->ic_perm;
+      seg = s;
+      nseg++;
+    }
+  }
+  if (nseg == 0) {
+    return -E_INVAL;
+  }
+
+  // 只读页面整页位于文件内容中，直接共享文件页面，不设置 PTE_D
+  if (nseg == 1 && !(perm & PTE_D) && page_va >= seg->ic_va &&
+      page_va + PAGE_SIZE <= seg->ic_va + seg->ic_filesz &&
+      (seg->ic_offset + (page_va - seg->ic_va)) % PAGE_SIZE == 0) {
+    struct Page *page = image->im_pages[(seg->ic_offset + (page_va - seg->ic_va)) / PAGE_SIZE];
+    return page_insert(env->env_pgdir, env->env_asid, page, page_va, perm);
+  }
+
+  // 否则复制页面与各个段在文件中的内容相交的部分，其余部分为零
+  struct Page *page;
+  try(page_alloc(&page));
+  for (u_int i = 0; i < image->im_nseg; i++) {
+    struct Icode_seg *s = &image->im_segs[i];
+    u_long start = MAX(page_va, s->ic_va);
+    u_long end = MIN(page_va + PAGE_SIZE, s->ic_va + s->ic_filesz);
+    if (start < end) {
+      icode_copy(image, (void *)(page2kva(page) + start - page_va), s->ic_offset + start - s->ic_va,
+                 end - start);
+    }
+  }
+  int func_info = page_insert(env->env_pgdir, env->env_asid, page, page_va, perm);
+  if (func_info < 0) {
+    page_free(page);
+  }
+  return func_info;
+}
+
+/* Overview:
+ *   Like 'page_lookup' on the address space of 'env', but a page of its 'env_image' that has not
+ *   been accessed yet is filled first (see 'icode_fault'), as a TLB miss would do. Use this when
+ *   the kernel looks up a user page on behalf of 'env' (e.g. pages to share or to transfer by
+ *   DMA), so that untouched pages of the segments are not taken as unmapped.
+ */
+// 查找进程的页面，按需加载的可执行文件中尚未填充的页面先填充
+struct Page *env_page_lookup(struct Env *env, u_long va, Pte **ppte) {
+  struct Page *page = page_lookup(env->env_pgdir, va, ppte);
+  if (page == NULL && env->env_image != NULL && icode_fault(env, va) == 0) {
+    page = page_lookup(env->env_pgdir, va, ppte);
+  }
+  return page;
+}
+
+/* Overview:
+ *   Load program segments from 'binary' into user space of the env 'e'.
+ *   'binary' points to an ELF executable image of 'size' bytes, which contains both text and data
+ *   segments.
+ */
+// 加载可执行文件binary到进程env的内存中
+static void load_icode(struct Env *env, const void *binary, size_t size) {
+  int func_info = env_load_icode(env, binary, size, NULL);
+  if (func_info == -E_NOT_EXEC) {
+    panic("bad elf at %x", binary);
+  }
+  panic_on(func_info);
 }
 
 /* Overview:
@@ -390,6 +712,19 @@ struct Env *env_create(const void *binary, size_t size, int priority) {
   return env;
 }
 
+/* Overview:
+ *   Release the segments saved by an env that was blocked sending an IPC message, once the
+ *   message has been taken or dropped.
+ */
+// 释放阻塞发送期间保存的消息片段
+void env_ipc_release_segs(struct Env *env) {
+  if (env->env_ipc_send_segs != &env->env_ipc_send_seg) {
+    kfree(env->env_ipc_send_segs);
+  }
+  env->env_ipc_send_segs = NULL;
+  env->env_ipc_send_nseg = 0;
+}
+
 /* Overview:
  *  Free env e and all memory it uses.
  */
@@ -411,8 +746,16 @@ void env_free(struct Env *env) {
     physical_address = PTE_ADDR(env->env_pgdir[pde_i]);
     pte = (Pte *)KADDR(physical_address);
     /* Hint: Unmap all PTEs in this page table. */
+    // 与其他进程共享的页表（见 sys_fork）只需释放对页表本身的引用，
+    // 但 TLB 中仍可能有以本进程 ASID 缓存的表项，需要在 ASID 被复用前使其无效
+    int shared = pa2page(physical_address)->pp_ref > 1;
     for (pte_i = 0; pte_i <= PTX(~0); pte_i++) {
-      if (pte[pte_i] & PTE_V) {
+      if (!(pte[pte_i] & PTE_V)) {
+        continue;
+      }
+      if (shared) {
+        tlb_invalidate(env->env_asid, (pde_i << PDSHIFT) | (pte_i << PGSHIFT));
+      } else {
         page_remove(env->env_pgdir, env->env_asid, (pde_i << PDSHIFT) | (pte_i << PGSHIFT));
       }
     }
@@ -424,14 +767,39 @@ void env_free(struct Env *env) {
   }
   /* Hint: free the page directory. */
   page_decref(pa2page(PADDR(env->env_pgdir)));
-  /* Hint: free the ASID */
-  asid_free(env->env_asid);
+  // 释放按需加载的可执行文件
+  icode_image_put(env->env_image);
+  env->env_image = NULL;
   /* Hint: invalidate page directory in TLB */
   tlb_invalidate(env->env_asid, UVPT + (PDX(UVPT) << PGSHIFT));
+  /* Hint: free the ASID */
+  // 所有以该 ASID 缓存的 TLB 表项都已无效，之后才能分配给其他进程
+  asid_free(env->env_asid);
+  /* Hint: leave the IPC wait queues. */
+  // 正在阻塞发送：从接收方的等待队列中移除
+  if (env->env_ipc_send_to != NULL) {
+    TAILQ_REMOVE(&env->env_ipc_send_to->env_ipc_senders, env, env_ipc_send_link);
+    env->env_ipc_send_to = NULL;
+    env_ipc_release_segs(env);
+  }
+  // 唤醒所有等待向该进程发送的进程，发送失败
+  struct Env *sender;
+  while ((sender = TAILQ_FIRST(&env->env_ipc_senders)) != NULL) {
+    TAILQ_REMOVE(&env->env_ipc_senders, sender, env_ipc_send_link);
+    sender->env_ipc_send_to = NULL;
+    sender->env_ipc_calling = 0;
+    env_ipc_release_segs(sender);
+    sender->env_tf.regs[2] = -E_BAD_ENV;
+    sender->env_status = ENV_RUNNABLE;
+    TAILQ_INSERT_TAIL(&env_sched_list, sender, env_sched_link);
+  }
   /* Hint: return the environment to the free list. */
+  // 被阻塞的进程已经不在调度队列中
+  if (env->env_status != ENV_NOT_RUNNABLE) {
+    TAILQ_REMOVE(&env_sched_list, (env), env_sched_link);
+  }
   env->env_status = ENV_FREE;
   LIST_INSERT_HEAD((&env_free_list), (env), env_link);
-  TAILQ_REMOVE(&env_sched_list, (env), env_sched_link);
 }
 
 /* Overview:
@@ -493,10 +861,15 @@ void env_run(struct Env *e) {
   // 设置全局变量cur_pgdir为当前进程页目录地址，在TLB重填时将用到该全局变量
   cur_pgdir = curenv->env_pgdir;
 
+  // 进程还没有ASID，或其ASID属于已经过期的代，需要重新分配
+  if (ASID_GEN(curenv->env_asid) != asid_generation) {
+    asid_alloc(curenv);
+  }
+
   // 根据栈帧还原进程上下文，并进行进程调度、运行程序
   // 恢复现场、设置时钟中断、异常返回
   // 这是一个汇编函数
-  env_pop_tf(&curenv->env_tf, curenv->env_asid);
+  env_pop_tf(&curenv->env_tf, curenv->env_asid & (NASID - 1));
 }
 
 void env_check() {
@@ -0,0 +1,344 @@
+#include <asm/cp0regdef.h>
+#include <env.h>
+#include <ide.h>
+#include <io.h>
+#include <kmalloc.h>
+#include <malta.h>
+#include <pmap.h>
+#include <printk.h>
+
+// IDE 磁盘的中断处理
+// - 磁盘中断经 PIIX4 的从片 i8259 的 IRQ14、主片的 IRQ2 级联，最终接到 CPU 的 2 号硬件中断（IM2）
+// - 文件服务进程发出命令后通过 sys_ide_wait 阻塞，由磁盘中断唤醒，不再轮询磁盘状态
+// - 中断在进程开始等待之前到达时记录下来，下一次等待立即返回
+// - 支持 PIIX4 的总线主控 DMA：sys_ide_dma 发出命令后阻塞调用者，由传输完成的中断唤醒，数据不经过 CPU
+
+extern struct Env envs[];
+
+// 是否已经初始化 i8259，允许磁盘中断
+int ide_irq_enabled;
+// 已经到达但还没有进程等待的磁盘中断
+static int ide_irq_pending;
+// 正在等待磁盘中断的进程的 envid，没有时为 0
+static u_int ide_waiter;
+// 等待进程已经阻塞的时钟中断数
+static u_int ide_wait_ticks;
+
+// 总线主控 DMA 是否可用，及其寄存器的物理地址
+static int ide_dma_enabled;
+static u_long ide_bm_base;
+// PRD 表，占据一个物理页面，不会跨越 64 KB 边界
+static struct Ide_prd *ide_prdt;
+// 是否有正在进行的 DMA 传输，其完成时唤醒 ide_waiter
+static int ide_dma_active;
+
+/* Overview:
+ *   Initialize the master and slave i8259 interrupt controllers, and unmask only the IDE
+ *   interrupt (IRQ14) and the cascade (IRQ2) it comes through. Envs created from now on accept
+ *   the interrupt (STATUS_IM2).
+ *   MIPS has no interrupt acknowledge cycle: the interrupt number is read by polling the
+ *   controllers in 'do_irq_i8259', so the vector bases set here are never used.
+ */
+// 初始化 i8259 中断控制器，只允许磁盘中断
+void ide_irq_init(void) {
+  // ICW1：边沿触发，级联，需要 ICW4
+  iowrite8(0x11, MALTA_I8259_MASTER_CMD);
+  iowrite8(0x11, MALTA_I8259_SLAVE_CMD);
+  // ICW2：中断向量的基址
+  iowrite8(0x20, MALTA_I8259_MASTER_DATA);
+  iowrite8(0x28, MALTA_I8259_SLAVE_DATA);
+  // ICW3：从片接在主片的 IRQ2 上
+  iowrite8(1 << MALTA_IRQ_CASCADE, MALTA_I8259_MASTER_DATA);
+  iowrite8(MALTA_IRQ_CASCADE, MALTA_I8259_SLAVE_DATA);
+  // ICW4：8086 模式，需要显式发送 EOI
+  iowrite8(0x01, MALTA_I8259_MASTER_DATA);
+  iowrite8(0x01, MALTA_I8259_SLAVE_DATA);
+  // OCW1：屏蔽除级联与磁盘以外的全部中断
+  iowrite8(~(1 << MALTA_IRQ_CASCADE) & 0xff, MALTA_I8259_MASTER_DATA);
+  iowrite8(~(1 << (MALTA_IRQ_IDE - 8)) & 0xff, MALTA_I8259_SLAVE_DATA);
+
+  ide_irq_enabled = 1;
+  printk("ide: interrupt enabled (irq %d)\n", MALTA_IRQ_IDE);
+}
+
+// 唤醒等待磁盘中断的进程，其系统调用的返回值为 ret，返回是否有进程被唤醒
+static int ide_wakeup(int ret) {
+  struct Env *env = &envs[ENVX(ide_waiter)];
+  int woken = 0;
+  // 等待的进程可能已经被销毁
+  if (ide_waiter != 0 && env->env_id == ide_waiter && env->env_status == ENV_NOT_RUNNABLE) {
+    env->env_tf.regs[2] = ret;
+    env->env_status = ENV_RUNNABLE;
+    TAILQ_INSERT_TAIL(&env_sched_list, env, env_sched_link);
+    woken = 1;
+  }
+  ide_waiter = 0;
+  return woken;
+}
+
+// 结束 DMA 传输：停止总线主控，清除其状态，返回传输的结果
+static int ide_dma_finish(void) {
+  uint8_t bm_status = ioread8(ide_bm_base + MALTA_IDE_BM_STATUS);
+  iowrite8(0, ide_bm_base + MALTA_IDE_BM_CMD);
+  iowrite8(bm_status | MALTA_IDE_BM_STATUS_ERR | MALTA_IDE_BM_STATUS_IRQ,
+           ide_bm_base + MALTA_IDE_BM_STATUS);
+  // 读取状态寄存器，同时清除磁盘的中断请求
+  uint8_t status = ioread8(MALTA_IDE_STATUS);
+  ide_dma_active = 0;
+  if ((bm_status & MALTA_IDE_BM_STATUS_ERR) || (status & MALTA_IDE_STAT_ERR)) {
+    printk("ide: dma failed, bus master status %02x, status %02x\n", bm_status, status);
+    return -E_UNSPECIFIED;
+  }
+  return 0;
+}
+
+// 从 i8259 查询正在请求的中断号，返回 -1 表示没有中断（伪中断）
+static int i8259_poll(u_long cmd_port) {
+  iowrite8(MALTA_I8259_POLL, cmd_port);
+  uint8_t irq = ioread8(cmd_port);
+  return (irq & 0x80) ? (irq & 0x7) : -1;
+}
+
+/* Overview:
+ *   Handle the interrupt from the i8259 controllers (STATUS_IM2), called by 'handle_int'.
+ *   For the IDE interrupt, read the IDE status to clear the request of the device, and wake up
+ *   the env waiting in 'sys_ide_wait'.
+ */
+// i8259 中断的处理函数
+void do_irq_i8259(void) {
+  int irq = i8259_poll(MALTA_I8259_MASTER_CMD);
+  if (irq < 0) {
+    return;
+  }
+  if (irq == MALTA_IRQ_CASCADE) {
+    int slave_irq = i8259_poll(MALTA_I8259_SLAVE_CMD);
+    if (slave_irq >= 0) {
+      irq = 8 + slave_irq;
+    }
+  }
+
+  if (irq == MALTA_IRQ_IDE) {
+    if (ide_dma_active) {
+      // DMA 传输完成，结果作为 sys_ide_dma 的返回值
+      ide_wakeup(ide_dma_finish());
+    } else {
+      // 读取状态寄存器，清除磁盘的中断请求
+      ioread8(MALTA_IDE_STATUS);
+      ide_irq_pending = !ide_wakeup(0);
+    }
+  }
+
+  // 先结束从片上的中断，再结束主片上的中断
+  if (irq >= 8) {
+    iowrite8(MALTA_I8259_EOI, MALTA_I8259_SLAVE_CMD);
+  }
+  iowrite8(MALTA_I8259_EOI, MALTA_I8259_MASTER_CMD);
+}
+
+/* Overview:
+ *   Prepare 'env' to wait for the next IDE interrupt.
+ *
+ * Post-Condition:
+ *   Return 0 if an interrupt has already arrived (it is consumed), 1 if 'env' is recorded as the
+ *   waiter and must be blocked by the caller, or -E_NO_SYS if the IDE interrupt is not enabled.
+ */
+// 准备等待磁盘中断：中断已经到达时直接返回
+int ide_wait(struct Env *env) {
+  if (!ide_irq_enabled) {
+    return -E_NO_SYS;
+  }
+  if (ide_irq_pending || ide_dma_active) {
+    ide_irq_pending = 0;
+    return 0;
+  }
+  ide_waiter = env->env_id;
+  ide_wait_ticks = 0;
+  return 1;
+}
+
+/* Overview:
+ *   Called on each timer interrupt. Wake up the env waiting for an IDE interrupt after
+ *   IDE_WAIT_TIMEOUT_TICKS ticks, so that a lost interrupt only delays it instead of blocking it
+ *   forever; it checks the IDE status again by itself.
+ */
+// 时钟中断时检查等待磁盘中断的进程是否超时
+void ide_tick(void) {
+  if (ide_dma_active) {
+    // DMA 传输只在总线主控停止或设备已发出中断后才能结束，否则继续等待
+    if (++ide_wait_ticks >= IDE_WAIT_TIMEOUT_TICKS) {
+      uint8_t bm_status = ioread8(ide_bm_base + MALTA_IDE_BM_STATUS);
+      if ((bm_status & MALTA_IDE_BM_STATUS_IRQ) || !(bm_status & MALTA_IDE_BM_STATUS_ACTIVE)) {
+        ide_wakeup(ide_dma_finish());
+      }
+    }
+    return;
+  }
+  if (ide_waiter == 0 || ++ide_wait_ticks < IDE_WAIT_TIMEOUT_TICKS) {
+    return;
+  }
+  ide_wakeup(0);
+}
+
+/* Overview:
+ *   Idle until an env becomes runnable, called by 'schedule' when no env is runnable but one is
+ *   waiting for the IDE disk. Only the IDE interrupt is enabled: 'do_irq_i8259' wakes the waiter
+ *   and returns here. Timer interrupts stay masked (their handler would re-enter 'schedule'); the
+ *   pending timer interrupt is polled and acknowledged instead, so that 'ide_tick' still wakes
+ *   the waiter on a lost interrupt.
+ *
+ * Post-Condition:
+ *   Return when 'env_sched_list' is not empty, or no env is waiting for the disk any more (the
+ *   waiter has been destroyed).
+ */
+// 没有就绪进程但有进程等待磁盘时，开中断空转，直到磁盘中断唤醒等待的进程
+void ide_idle(void) {
+  u_int status, cause, compare;
+  asm volatile("mfc0 %0, $12" : "=r"(status));
+
+  for (;;) {
+    // 检查与修改等待状态时关闭中断，避免与中断处理函数竞争
+    if (!TAILQ_EMPTY(&env_sched_list) || (ide_waiter == 0 && !ide_dma_active)) {
+      break;
+    }
+    asm volatile("mfc0 %0, $13" : "=r"(cause));
+    if (cause & STATUS_IM7) {
+      // 时钟中断到达：重写 Compare 清除中断，计数从 0 重新开始
+      asm volatile("mfc0 %0, $11" : "=r"(compare));
+      asm volatile("mtc0 $0, $9\n\tmtc0 %0, $11" : : "r"(compare));
+      ide_tick();
+      continue;
+    }
+    // 只开放磁盘中断，短暂开中断后再检查
+    asm volatile("mtc0 %0, $12" : : "r"((status & ~0xff00) | STATUS_IM2 | STATUS_IE));
+    asm volatile("nop\n\tnop\n\tnop\n\tnop" : : : "memory");
+    asm volatile("mtc0 %0, $12" : : "r"(status & ~STATUS_IE) : "memory");
+  }
+
+  asm volatile("mtc0 %0, $12" : : "r"(status) : "memory");
+}
+
+// 读写 PIIX4 的 IDE 功能的 PCI 配置空间
+static uint32_t piix4_ide_cfg_read(u_int reg) {
+  iowrite32(MALTA_PCI_CFG_ADDR(MALTA_PIIX4_DEV, MALTA_PIIX4_IDE_FUNC, reg), MALTA_GT_PCI_CFGADDR);
+  return ioread32(MALTA_GT_PCI_CFGDATA);
+}
+
+static void piix4_ide_cfg_write(u_int reg, uint32_t value) {
+  iowrite32(MALTA_PCI_CFG_ADDR(MALTA_PIIX4_DEV, MALTA_PIIX4_IDE_FUNC, reg), MALTA_GT_PCI_CFGADDR);
+  iowrite32(value, MALTA_GT_PCI_CFGDATA);
+}
+
+/* Overview:
+ *   Enable the bus master DMA of the PIIX4 IDE controller: find (or assign) its I/O base in BAR4
+ *   through the PCI configuration space, enable I/O decoding and bus mastering, and allocate the
+ *   PRD table. DMA needs the IDE interrupt for completion, so 'ide_irq_init' must be called
+ *   first; otherwise DMA stays disabled and 'sys_ide_dma' returns -E_NO_SYS.
+ */
+// 初始化 IDE 控制器的总线主控 DMA
+void ide_dma_init(void) {
+  if (!ide_irq_enabled) {
+    return;
+  }
+
+  uint32_t bar = piix4_ide_cfg_read(MALTA_PCI_BAR4);
+  // BAR4 应为 I/O 空间的地址
+  if (bar == 0xffffffff || !(bar & 0x1)) {
+    printk("ide: no bus master interface, dma disabled\n");
+    return;
+  }
+  if ((bar & ~0x3) == 0) {
+    bar = MALTA_IDE_BM_DEFAULT_BASE | 0x1;
+    piix4_ide_cfg_write(MALTA_PCI_BAR4, bar);
+  }
+  // 写回命令寄存器时不改变高 16 位的状态寄存器（写 1 清除）
+  uint32_t command = piix4_ide_cfg_read(MALTA_PCI_COMMAND) & 0xffff;
+  piix4_ide_cfg_write(MALTA_PCI_COMMAND,
+                      command | MALTA_PCI_COMMAND_IO | MALTA_PCI_COMMAND_MASTER);
+
+  if ((ide_prdt = kmalloc(PAGE_SIZE)) == NULL) {
+    printk("ide: no memory for the prd table, dma disabled\n");
+    return;
+  }
+  ide_bm_base = MALTA_PCIIO_BASE + (bar & ~0x3);
+  ide_dma_enabled = 1;
+  printk("ide: bus master dma at i/o %04x\n", bar & ~0x3);
+}
+
+/* Overview:
+ *   Start a DMA transfer of 'nsect' sectors from sector 'sec_no' of disk 'disk_no' into memory at
+ *   'va' of 'env' ('to_disk' == 0), or from memory to the disk. The PRD table describes the
+ *   physical pages behind 'va', merging physically contiguous ones.
+ *
+ * Pre-Condition:
+ *   ['va', 'va' + 'nsect' * 512) is in user space. The IDE device is not busy.
+ *
+ * Post-Condition:
+ *   Return 1 if the transfer has started and 'env' is recorded as the waiter, which must be
+ *   blocked by the caller; its return value is set on completion.
+ *   Return -E_NO_SYS if DMA is not enabled, or -E_INVAL if the arguments are bad or a page is not
+ *   mapped (with 'PTE_D' for transfers into memory).
+ *
+ * Note:
+ *   No D-cache writeback/invalidation is done around the transfer, which MOS has NOT implemented.
+ *   QEMU doesn't simulate caching, allowing the OS to function correctly.
+ */
+// 发起 DMA 传输，由调用者阻塞等待其完成
+int ide_dma_start(struct Env *env, u_int disk_no, u_int sec_no, u_long va, u_int nsect,
+                  int to_disk) {
+  if (!ide_dma_enabled) {
+    return -E_NO_SYS;
+  }
+  if (disk_no >= 2 || nsect == 0 || nsect > MALTA_IDE_MAX_NSECT || va % 4 != 0 ||
+      ide_dma_active) {
+    return -E_INVAL;
+  }
+
+  // 构造 PRD 表：每一项描述一段物理连续、不跨越 64 KB 边界的内存，长度 0 表示 64 KB
+  u_int len = nsect * 512;
+  int nprd = 0;
+  u_long prd_end = 0;
+  u_int prd_len = 0;
+  for (u_int off = 0; off < len;) {
+    Pte *pte;
+    struct Page *page = env_page_lookup(env, va + off, &pte);
+    if (page == NULL || (!to_disk && !(*pte & PTE_D))) {
+      return -E_INVAL;
+    }
+    u_long pa = page2pa(page) + (va + off) % PAGE_SIZE;
+    u_int n = MIN(PAGE_SIZE - (va + off) % PAGE_SIZE, len - off);
+    if (nprd == 0 || pa != prd_end || pa % MALTA_IDE_PRD_MAX == 0) {
+      ide_prdt[nprd].prd_addr = pa;
+      ide_prdt[nprd].prd_flag = 0;
+      nprd++;
+      prd_len = 0;
+    }
+    prd_len += n;
+    ide_prdt[nprd - 1].prd_len = prd_len & 0xffff;
+    prd_end = pa + n;
+    off += n;
+  }
+  ide_prdt[nprd - 1].prd_flag = MALTA_IDE_PRD_EOT;
+
+  // 设置总线主控：停止之前的传输，清除状态，设置 PRD 表与传输方向
+  iowrite8(0, ide_bm_base + MALTA_IDE_BM_CMD);
+  iowrite8(MALTA_IDE_BM_STATUS_ERR | MALTA_IDE_BM_STATUS_IRQ, ide_bm_base + MALTA_IDE_BM_STATUS);
+  iowrite32(PADDR(ide_prdt), ide_bm_base + MALTA_IDE_BM_PRDT);
+  uint8_t bm_cmd = to_disk ? 0 : MALTA_IDE_BM_CMD_TO_MEMORY;
+  iowrite8(bm_cmd, ide_bm_base + MALTA_IDE_BM_CMD);
+
+  // 设置扇区数、扇区号、磁盘号，发出 DMA 读写命令
+  iowrite8(nsect & 0xff, MALTA_IDE_NSECT);
+  iowrite8(sec_no & 0xff, MALTA_IDE_LBAL);
+  iowrite8((sec_no >> 8) & 0xff, MALTA_IDE_LBAM);
+  iowrite8((sec_no >> 16) & 0xff, MALTA_IDE_LBAH);
+  iowrite8(((sec_no >> 24) & 0x0f) | MALTA_IDE_LBA | (disk_no << 4), MALTA_IDE_DEVICE);
+  iowrite8(to_disk ? MALTA_IDE_CMD_DMA_WRITE : MALTA_IDE_CMD_DMA_READ, MALTA_IDE_STATUS);
+
+  // 启动总线主控，传输完成时由磁盘中断唤醒调用者
+  iowrite8(bm_cmd | MALTA_IDE_BM_CMD_START, ide_bm_base + MALTA_IDE_BM_CMD);
+  ide_dma_active = 1;
+  ide_irq_pending = 0;
+  ide_waiter = env->env_id;
+  ide_wait_ticks = 0;
+  return 1;
+}
@@ -3,7 +3,7 @@ lab-ge = $(shell [ "$$(echo $(lab)_ | cut -f1 -d_)" -ge $(1) ] && echo true)
 targets             := machine.o printk.o panic.o
 
 ifeq ($(call lab-ge,2), true)
-	targets     += pmap.o tlb_asm.o tlbex.o
+	targets     += pmap.o tlb_asm.o tlbex.o kmalloc.o
 endif
 
 ifeq ($(call lab-ge,3), true)
@@ -13,3 +13,7 @@ endif
 ifeq ($(call lab-ge,4), true)
 	targets     += syscall_all.o
 endif
+
+ifeq ($(call lab-ge,5), true)
+	targets     += ide.o
+endif
@@ -0,0 +1,289 @@
+#include <kmalloc.h>
+#include <pmap.h>
+#include <printk.h>
+
+// 内核动态内存分配：在页分配器之上实现的 slab 分配器
+// - 小对象（不超过 KMALLOC_MAX_SIZE）按 2 的幂大小分到各个 cache 中，由 slab 分配
+// - 大对象直接按页分配：单页来自 page_alloc，多页的连续块来自伙伴系统
+
+// kmalloc 使用的各级 cache：16, 32, ..., 1024 字节
+static struct kmem_cache kmalloc_caches[KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1] = {
+    KMEM_CACHE_INITIALIZER("kmalloc-16", 16),   KMEM_CACHE_INITIALIZER("kmalloc-32", 32),
+    KMEM_CACHE_INITIALIZER("kmalloc-64", 64),   KMEM_CACHE_INITIALIZER("kmalloc-128", 128),
+    KMEM_CACHE_INITIALIZER("kmalloc-256", 256), KMEM_CACHE_INITIALIZER("kmalloc-512", 512),
+    KMEM_CACHE_INITIALIZER("kmalloc-1024", 1024),
+};
+
+// slab 头部之后第一个对象的偏移
+#define SLAB_OBJ_OFFSET ROUND(sizeof(struct Slab), 8)
+
+// 获取对象所在的 slab：slab 总是占据一个完整的页，页首即为 slab 头部
+static inline struct Slab *obj2slab(void *obj) {
+  return (struct Slab *)ROUNDDOWN(obj, PAGE_SIZE);
+}
+
+// 获取内核虚拟地址对应的页控制块
+static inline struct Page *kva2page(void *kva) {
+  return pa2page(PADDR(kva));
+}
+
+/* Overview:
+ *   Initialize a cache for objects of 'size' bytes. Caches may also be defined statically with
+ *   KMEM_CACHE_INITIALIZER.
+ */
+void kmem_cache_init(struct kmem_cache *cache, const char *name, u_int size) {
+  cache->kc_name = name;
+  cache->kc_size = ROUND(size, 8);
+  cache->kc_objs = 0;
+  LIST_INIT(&cache->kc_full);
+  LIST_INIT(&cache->kc_partial);
+  LIST_INIT(&cache->kc_free);
+  cache->kc_nfree = 0;
+  cache->kc_nalloc = 0;
+}
+
+/* Overview:
+ *   Get a new page from the page allocator and turn it into a slab of 'cache', with all of its
+ *   objects chained on the slab's free list.
+ *
+ * Post-Condition:
+ *   Return the new slab, or NULL if we're out of memory.
+ */
+static struct Slab *slab_create(struct kmem_cache *cache) {
+  struct Page *page;
+  // slab 的内容会被完整地初始化，不需要清零的页
+  if (page_alloc_nozero(&page) != 0) {
+    return NULL;
+  }
+  // 标记该页已被 slab 占用
+  page->pp_ref = 1;
+  page->pp_flags |= PAGE_SLAB;
+
+  struct Slab *slab = (struct Slab *)page2kva(page);
+  slab->sl_cache = cache;
+  slab->sl_inuse = 0;
+  slab->sl_free = NULL;
+
+  // 将页中的对象逆序串成空闲链表，使分配时地址递增
+  u_long base = (u_long)slab + SLAB_OBJ_OFFSET;
+  for (int i = cache->kc_objs - 1; i >= 0; i--) {
+    void **obj = (void **)(base + i * cache->kc_size);
+    *obj = slab->sl_free;
+    slab->sl_free = obj;
+  }
+  return slab;
+}
+
+// 将全空闲的 slab 所在的页归还给页分配器
+static void slab_destroy(struct Slab *slab) {
+  struct Page *page = kva2page(slab);
+  page->pp_flags &= ~PAGE_SLAB;
+  page_decref(page);
+}
+
+/* Overview:
+ *   Allocate an object from 'cache'. Partially used slabs are preferred, then empty slabs kept by
+ *   the cache; a new slab is created only if neither exists.
+ *
+ * Post-Condition:
+ *   Return the object, or NULL if we're out of memory. The content of the object is undefined.
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+  struct Slab *slab;
+
+  // 首次使用时计算每个 slab 能容纳的对象数量
+  if (cache->kc_objs == 0) {
+    assert(cache->kc_size > 0 && cache->kc_size <= PAGE_SIZE - SLAB_OBJ_OFFSET);
+    cache->kc_objs = (PAGE_SIZE - SLAB_OBJ_OFFSET) / cache->kc_size;
+  }
+
+  if (!LIST_EMPTY(&cache->kc_partial)) {
+    slab = LIST_FIRST(&cache->kc_partial);
+  } else {
+    if (!LIST_EMPTY(&cache->kc_free)) {
+      slab = LIST_FIRST(&cache->kc_free);
+      LIST_REMOVE(slab, sl_link);
+      cache->kc_nfree--;
+    } else if ((slab = slab_create(cache)) == NULL) {
+      return NULL;
+    }
+    LIST_INSERT_HEAD(&cache->kc_partial, slab, sl_link);
+  }
+
+  // 从 slab 的空闲链表中取出一个对象
+  void **obj = slab->sl_free;
+  slab->sl_free = *obj;
+  slab->sl_inuse++;
+  cache->kc_nalloc++;
+
+  // slab 已满，移入 full 链表
+  if (slab->sl_inuse == cache->kc_objs) {
+    LIST_REMOVE(slab, sl_link);
+    LIST_INSERT_HEAD(&cache->kc_full, slab, sl_link);
+  }
+  return obj;
+}
+
+/* Overview:
+ *   Give 'obj' back to the slab of 'cache' it was allocated from. A slab that becomes empty is
+ *   kept for reuse, unless the cache already keeps KMEM_CACHE_KEEP_FREE empty slabs, in which case
+ *   its page is released.
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+  struct Slab *slab = obj2slab(obj);
+  assert(slab->sl_cache == cache);
+  assert(slab->sl_inuse > 0);
+
+  // 之前已满的 slab 现在有了空闲对象
+  if (slab->sl_inuse == cache->kc_objs) {
+    LIST_REMOVE(slab, sl_link);
+    LIST_INSERT_HEAD(&cache->kc_partial, slab, sl_link);
+  }
+
+  *(void **)obj = slab->sl_free;
+  slab->sl_free = obj;
+  slab->sl_inuse--;
+  cache->kc_nalloc--;
+
+  // slab 中的对象全部空闲
+  if (slab->sl_inuse == 0) {
+    LIST_REMOVE(slab, sl_link);
+    if (cache->kc_nfree < KMEM_CACHE_KEEP_FREE) {
+      LIST_INSERT_HEAD(&cache->kc_free, slab, sl_link);
+      cache->kc_nfree++;
+    } else {
+      slab_destroy(slab);
+    }
+  }
+}
+
+/* Overview:
+ *   Allocate 'size' bytes of kernel memory. Requests up to KMALLOC_MAX_SIZE are served by the
+ *   smallest fitting kmalloc cache; larger ones get whole pages, physically contiguous if more
+ *   than one page is needed.
+ *
+ * Post-Condition:
+ *   Return a kseg0 address, or NULL if 'size' is 0 or we're out of memory.
+ */
+void *kmalloc(size_t size) {
+  if (size == 0) {
+    return NULL;
+  }
+
+  if (size <= KMALLOC_MAX_SIZE) {
+    // 找到能容纳 size 的最小的 cache
+    u_int shift = KMALLOC_MIN_SHIFT;
+    while ((1u << shift) < size) {
+      shift++;
+    }
+    return kmem_cache_alloc(&kmalloc_caches[shift - KMALLOC_MIN_SHIFT]);
+  }
+
+  // 大对象：按页分配，并在页控制块中记录分配的阶数
+  struct Page *page;
+  u_int order = 0;
+  while ((PAGE_SIZE << order) < size) {
+    order++;
+  }
+  if (order == 0) {
+    if (page_alloc_nozero(&page) != 0) {
+      return NULL;
+    }
+  } else if (pages_alloc(&page, order) != 0) {
+    return NULL;
+  }
+  page->pp_ref = 1;
+  page->pp_order = order;
+  page->pp_flags |= PAGE_KMALLOC;
+  return (void *)page2kva(page);
+}
+
+/* Overview:
+ *   Free memory returned by 'kmalloc'. Passing NULL does nothing.
+ */
+void kfree(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+
+  struct Page *page = kva2page(ptr);
+  if (page->pp_flags & PAGE_SLAB) {
+    struct Slab *slab = obj2slab(ptr);
+    kmem_cache_free(slab->sl_cache, ptr);
+    return;
+  }
+
+  assert(page->pp_flags & PAGE_KMALLOC);
+  assert(ptr == (void *)page2kva(page));
+  page->pp_flags &= ~PAGE_KMALLOC;
+  page->pp_ref = 0;
+  if (page->pp_order == 0) {
+    page_free(page);
+  } else {
+    pages_free(page, page->pp_order);
+  }
+}
+
+void kmalloc_check(void) {
+  struct kmem_cache test_cache;
+  void *a, *b, *c;
+  void *objs[64];
+
+  // objects of the same cache come from the same slab and are reused LIFO
+  kmem_cache_init(&test_cache, "test", 100);
+  assert(test_cache.kc_size == 104);
+  a = kmem_cache_alloc(&test_cache);
+  b = kmem_cache_alloc(&test_cache);
+  assert(a && b && a != b);
+  assert(obj2slab(a) == obj2slab(b));
+  assert(test_cache.kc_nalloc == 2);
+  kmem_cache_free(&test_cache, a);
+  assert(kmem_cache_alloc(&test_cache) == a);
+
+  // filling a slab moves it to the full list, the next object needs a new slab
+  struct Slab *first = obj2slab(a);
+  assert(test_cache.kc_objs <= 64);
+  objs[0] = a;
+  objs[1] = b;
+  for (u_int i = 2; i < test_cache.kc_objs; i++) {
+    objs[i] = kmem_cache_alloc(&test_cache);
+    assert(obj2slab(objs[i]) == first);
+  }
+  assert(LIST_FIRST(&test_cache.kc_full) == first);
+  c = kmem_cache_alloc(&test_cache);
+  assert(obj2slab(c) != first);
+  kmem_cache_free(&test_cache, c);
+  assert(test_cache.kc_nfree == 1);
+
+  // the second empty slab is given back to the page allocator
+  for (u_int i = 0; i < test_cache.kc_objs; i++) {
+    kmem_cache_free(&test_cache, objs[i]);
+  }
+  assert(test_cache.kc_nalloc == 0 && test_cache.kc_nfree == 1);
+  assert(LIST_EMPTY(&test_cache.kc_full) && LIST_EMPTY(&test_cache.kc_partial));
+  slab_destroy(LIST_FIRST(&test_cache.kc_free));
+
+  // kmalloc picks the smallest fitting cache
+  a = kmalloc(20);
+  assert(obj2slab(a)->sl_cache->kc_size == 32);
+  b = kmalloc(1024);
+  assert(obj2slab(b)->sl_cache->kc_size == 1024);
+  kfree(a);
+  kfree(b);
+  assert(kmalloc(20) == a);
+  kfree(a);
+
+  // large requests get whole pages
+  a = kmalloc(PAGE_SIZE);
+  assert(((u_long)a & (PAGE_SIZE - 1)) == 0);
+  assert(kva2page(a)->pp_order == 0);
+  b = kmalloc(3 * PAGE_SIZE);
+  assert(((u_long)b & (4 * PAGE_SIZE - 1)) == 0);
+  assert(kva2page(b)->pp_order == 2);
+  memset(b, 0xff, 3 * PAGE_SIZE);
+  kfree(a);
+  kfree(b);
+  kfree(NULL);
+
+  printk("kmalloc_check() succeeded!\n");
+}
@@ -34,6 +34,20 @@ static u_long free_memory_address;
 // 维护空闲页链表，在之后初始化
 struct Page_list page_free_list; /* Free list of physical pages */
 
+// 伙伴系统：物理内存最高处的一段页由伙伴系统单独管理，用于分配物理连续的多页
+// buddy_start 为伙伴系统管理的第一个页号，[buddy_start, npage) 不在 page_free_list 中
+u_long buddy_start;
+// 按阶数组织的空闲块链表，buddy_free_area[k] 中每个元素为一个 2^k 页空闲块的首页
+static struct Page_list buddy_free_area[BUDDY_MAX_ORDER + 1];
+
+static void buddy_init(u_long start, u_long end);
+
+// 预清零页池：其中的页已被清零，page_alloc 可以直接取用而无需 memset
+// 在 CPU 空闲时由 page_zero_refill 从 page_free_list 中补充
+static struct Page_list page_zero_list;
+static u_int page_zero_count;
+struct Page_zero_stat page_zero_stat;
+
 /* Overview:
  *   Use '_memsize' from bootloader to initialize 'memsize' and
  *   calculate the corresponding 'npage' value.
@@ -117,6 +131,9 @@ void page_init(void) {
   /* Step 1: Initialize page_free_list. */
   // 创建一个空闲页组成的链表
   LIST_INIT(&page_free_list);
+  // 预清零页池初始为空，在调度器空闲时才开始填充
+  LIST_INIT(&page_zero_list);
+  page_zero_count = 0;
 
   /* Step 2: Align `free_memory_address` up to multiple of PAGE_SIZE. */
   // 将当前已使用的空间进行对其
@@ -131,16 +148,27 @@ void page_init(void) {
     pages[i].pp_ref = 1;
   }
 
+  // 最高处的 1/BUDDY_ZONE_RATIO 的物理页交给伙伴系统管理
+  u_long zone_start = npage - npage / BUDDY_ZONE_RATIO;
+  if (zone_start < page_used) {
+    zone_start = page_used;
+  }
+
   // 很有意思，从高地址往下，kuseg是栈区
-  for(u_long i=page_used; i<npage; i++) {
+  for(u_long i=page_used; i<zone_start; i++) {
     pages[i].pp_ref = 0;
     // 为什么取地址：将地址转换为一个指针变量是方便的
     LIST_INSERT_HEAD(&page_free_list, &pages[i], pp_link);
   }
+
+  buddy_init(zone_start, npage);
 }
 
 /* Overview:
  *   Allocate a physical page from free memory, and fill this page with zero.
+ *   A page is taken from the pre-zeroed pool first; only when the pool is empty is a page taken
+ *   from 'page_free_list' and zeroed synchronously. When 'page_free_list' is empty too, an
+ *   order-0 block is taken from the buddy allocator.
  *
  * Post-Condition:
  *   If failed to allocate a new page (out of memory, there's no free page), return -E_NO_MEM.
@@ -155,23 +183,88 @@ void page_init(void) {
 // 创建相应的页控制块，从空闲页表链表中移除
 // 每个物理地址自动对应一个页控制块：实际的分配只能是物理地址
 int page_alloc(struct Page **new) {
+  struct Page *page_alloced;
+
+  // 优先从预清零页池中取页，O(1) 且无需清零
+  if (!LIST_EMPTY(&page_zero_list)) {
+    page_alloced = LIST_FIRST(&page_zero_list);
+    LIST_REMOVE(page_alloced, pp_link);
+    page_zero_count--;
+    page_zero_stat.hit++;
+    *new = page_alloced;
+    return 0;
+  }
+
   /* Step 1: Get a page from free memory. If fails, return the error code.*/
+  // 空闲页链表用尽时从伙伴系统中取单页，由 page_free 归还给伙伴系统
   if(LIST_EMPTY(&page_free_list)) {
-    return -E_NO_MEM;
+    page_zero_stat.miss++;
+    return pages_alloc(new, 0);
   }
 
-  struct Page *page_alloced;
   page_alloced = LIST_FIRST(&page_free_list);
   LIST_REMOVE(page_alloced, pp_link);
 
   /* Step 2: Initialize this page with zero. */
   // 获取页控制块对应的虚拟地址，并进行初始化清空
   memset((void *)page2kva(page_alloced), 0, PAGE_SIZE);
+  page_zero_stat.miss++;
 
   *new = page_alloced;
   return 0;
 }
 
+/* Overview:
+ *   Allocate a physical page whose content is unspecified. Use this when the caller overwrites
+ *   the whole page anyway (e.g. copying a page), so that no time is spent zeroing it and the
+ *   pre-zeroed pool is left for callers who need it.
+ *
+ * Post-Condition:
+ *   Same as 'page_alloc'.
+ */
+int page_alloc_nozero(struct Page **new) {
+  struct Page *page_alloced;
+
+  // 优先取未清零的空闲页，不够时再动用预清零页池，最后从伙伴系统中取单页
+  if (!LIST_EMPTY(&page_free_list)) {
+    page_alloced = LIST_FIRST(&page_free_list);
+  } else if (!LIST_EMPTY(&page_zero_list)) {
+    page_alloced = LIST_FIRST(&page_zero_list);
+    page_zero_count--;
+  } else {
+    return pages_alloc(new, 0);
+  }
+  LIST_REMOVE(page_alloced, pp_link);
+
+  *new = page_alloced;
+  return 0;
+}
+
+/* Overview:
+ *   Zero at most 'max' pages taken from 'page_free_list' and move them into the pre-zeroed pool,
+ *   until the pool holds PAGE_ZERO_POOL_MAX pages. Called when the CPU would otherwise be idle.
+ */
+void page_zero_refill(u_int max) {
+  struct Page *page_pointer;
+
+  while (max-- > 0 && page_zero_count < PAGE_ZERO_POOL_MAX && !LIST_EMPTY(&page_free_list)) {
+    page_pointer = LIST_FIRST(&page_free_list);
+    LIST_REMOVE(page_pointer, pp_link);
+    memset((void *)page2kva(page_pointer), 0, PAGE_SIZE);
+    LIST_INSERT_HEAD(&page_zero_list, page_pointer, pp_link);
+    page_zero_count++;
+    page_zero_stat.refill++;
+  }
+}
+
+// 输出预清零页池的命中情况
+void page_zero_report(void) {
+  u_int total = page_zero_stat.hit + page_zero_stat.miss;
+  printk("page zero pool: %d pages, hit %d, miss %d (hit rate %d%%), refilled %d\n",
+         page_zero_count, page_zero_stat.hit, page_zero_stat.miss,
+         total ? page_zero_stat.hit * 100 / total : 0, page_zero_stat.refill);
+}
+
 /* Overview:
  *   Release a page 'pp', mark it as free.
  *
@@ -180,10 +273,147 @@ int page_alloc(struct Page **new) {
  */
 void page_free(struct Page *page_pointer) {
   assert(page_pointer->pp_ref == 0);
+  // 来自伙伴系统的页（如拆开映射的连续块中的单页）归还给伙伴系统，以便合并
+  if (page2ppn(page_pointer) >= buddy_start) {
+    pages_free(page_pointer, 0);
+    return;
+  }
   /* Just insert it into 'page_free_list'. */
   LIST_INSERT_HEAD(&page_free_list, page_pointer, pp_link);
 }
 
+// 将块首页 page_pointer 作为 2^order 页的空闲块放入对应阶的链表
+static void buddy_insert(struct Page *page_pointer, u_int order) {
+  page_pointer->pp_order = order;
+  page_pointer->pp_flags |= PAGE_BUDDY_FREE;
+  LIST_INSERT_HEAD(&buddy_free_area[order], page_pointer, pp_link);
+}
+
+// 将空闲块从其所在阶的链表中取出
+static void buddy_remove(struct Page *page_pointer) {
+  LIST_REMOVE(page_pointer, pp_link);
+  page_pointer->pp_flags &= ~PAGE_BUDDY_FREE;
+}
+
+/* Overview:
+ *   Hand the physical pages [start, end) over to the buddy allocator. The range is cut into the
+ *   largest naturally aligned blocks (at most 2^BUDDY_MAX_ORDER pages) that fit.
+ */
+static void buddy_init(u_long start, u_long end) {
+  for (u_int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+    LIST_INIT(&buddy_free_area[order]);
+  }
+  buddy_start = start;
+
+  u_long ppn = start;
+  while (ppn < end) {
+    // 选取首页号按块大小对齐、且不越过 end 的最大块
+    u_int order = BUDDY_MAX_ORDER;
+    while (order > 0 && ((ppn & ((1UL << order) - 1)) != 0 || ppn + (1UL << order) > end)) {
+      order--;
+    }
+    pages[ppn].pp_ref = 0;
+    buddy_insert(&pages[ppn], order);
+    ppn += 1UL << order;
+  }
+}
+
+/* Overview:
+ *   Allocate 2^order physically contiguous pages from the buddy allocator, and fill them with
+ *   zero. The first page of the block is stored to *new, its page number is a multiple of 2^order.
+ *
+ * Post-Condition:
+ *   Return -E_INVAL if 'order' exceeds BUDDY_MAX_ORDER, -E_NO_MEM if no block is large enough.
+ *   Otherwise return 0.
+ *
+ * Note:
+ *   Like 'page_alloc', this does NOT increase 'pp_ref' of any page in the block.
+ */
+int pages_alloc(struct Page **new, u_int order) {
+  if (order > BUDDY_MAX_ORDER) {
+    return -E_INVAL;
+  }
+
+  // 找到不小于所需阶数的最小非空链表
+  u_int current_order = order;
+  while (current_order <= BUDDY_MAX_ORDER && LIST_EMPTY(&buddy_free_area[current_order])) {
+    current_order++;
+  }
+  if (current_order > BUDDY_MAX_ORDER) {
+    return -E_NO_MEM;
+  }
+
+  struct Page *page_alloced = LIST_FIRST(&buddy_free_area[current_order]);
+  buddy_remove(page_alloced);
+
+  // 块过大时逐次对半拆分，将后一半（伙伴）放回低一阶的链表
+  while (current_order > order) {
+    current_order--;
+    buddy_insert(page_alloced + (1UL << current_order), current_order);
+  }
+  page_alloced->pp_order = order;
+
+  memset((void *)page2kva(page_alloced), 0, PAGE_SIZE << order);
+
+  *new = page_alloced;
+  return 0;
+}
+
+/* Overview:
+ *   Give a block of 2^order pages obtained from 'pages_alloc' back to the buddy allocator. The
+ *   block is merged with its buddy as long as the buddy is free and of the same order.
+ *
+ * Pre-Condition:
+ *   The caller no longer references any page of the block.
+ */
+void pages_free(struct Page *page_pointer, u_int order) {
+  u_long ppn = page2ppn(page_pointer);
+  assert(ppn >= buddy_start);
+  assert(order <= BUDDY_MAX_ORDER);
+  assert((ppn & ((1UL << order) - 1)) == 0);
+
+  while (order < BUDDY_MAX_ORDER) {
+    // 伙伴块的页号只在第 order 位上与本块不同
+    u_long buddy_ppn = ppn ^ (1UL << order);
+    if (buddy_ppn < buddy_start || buddy_ppn + (1UL << order) > npage) {
+      break;
+    }
+    struct Page *buddy = &pages[buddy_ppn];
+    if (!(buddy->pp_flags & PAGE_BUDDY_FREE) || buddy->pp_order != order) {
+      break;
+    }
+    // 伙伴空闲，取出后合并为高一阶的块
+    buddy_remove(buddy);
+    ppn &= ~(1UL << order);
+    order++;
+  }
+
+  buddy_insert(&pages[ppn], order);
+}
+
+/* Overview:
+ *   Take all free blocks out of the buddy allocator into 'area', so that a check can run out of
+ *   memory by emptying 'page_free_list'. 'buddy_restore' gives them back.
+ *
+ * Pre-Condition:
+ *   No page of the buddy allocator is allocated or freed until 'buddy_restore'.
+ */
+// 暂时取走伙伴系统中的全部空闲块，用于检查内存耗尽时的行为
+void buddy_steal(struct Page_list *area) {
+  for (u_int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+    area[order] = buddy_free_area[order];
+    LIST_INIT(&buddy_free_area[order]);
+  }
+}
+
+// 归还 buddy_steal 取走的空闲块
+void buddy_restore(struct Page_list *area) {
+  for (u_int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+    assert(LIST_EMPTY(&buddy_free_area[order]));
+    buddy_free_area[order] = area[order];
+  }
+}
+
 /* Overview:
  *   Given 'pgdir', a pointer to a page directory, 'pgdir_walk' returns a pointer to
  *   the page table entry for virtual address 'va'.
@@ -231,6 +461,51 @@ static int pgdir_walk(Pde *pde_base, u_long virtural_address, int if_create, Pte
   return 0;
 }
 
+/* Overview:
+ *   Make the second-level page table covering 'va' in 'pgdir' private before it is modified.
+ *   After 'sys_fork', a page table may be shared by several page directories, in which case the
+ *   'pp_ref' of its page is greater than 1 and the page refs of the pages it maps are not
+ *   increased for the sharers. A shared page table is copied here, and the pages mapped in it get
+ *   one more reference for the copy.
+ *
+ * Post-Condition:
+ *   Return 0 on success (including when there is no page table at 'va' or it is not shared).
+ *   Return -E_NO_MEM if the copy cannot be allocated.
+ */
+// 修改二级页表前调用：与其他进程共享的页表需要先复制一份私有的
+int pgtable_unshare(Pde *pgdir, u_int asid, u_long va) {
+  Pde *pde = pgdir + PDX(va);
+  struct Page *table, *copy;
+
+  if (!(*pde & PTE_V)) {
+    return 0;
+  }
+  table = pa2page(PTE_ADDR(*pde));
+  if (table->pp_ref <= 1) {
+    return 0;
+  }
+
+  // 页表会被完整覆盖，不需要清零
+  if (page_alloc_nozero(&copy) != 0) {
+    return -E_NO_MEM;
+  }
+  Pte *ptes = (Pte *)page2kva(copy);
+  memcpy(ptes, (void *)page2kva(table), PAGE_SIZE);
+  // 复制出的页表中的映射也要计入页面的引用
+  for (u_int i = 0; i < PAGE_SIZE / sizeof(Pte); i++) {
+    if (ptes[i] & PTE_V) {
+      pa2page(ptes[i])->pp_ref++;
+    }
+  }
+
+  copy->pp_ref = 1;
+  table->pp_ref--;
+  *pde = page2pa(copy) | (*pde & 0xfff);
+  // 自映射区域中该页表的映射发生了变化
+  tlb_invalidate(asid, UVPT + (PDX(va) << PGSHIFT));
+  return 0;
+}
+
 /* Overview:
  *   Map the physical page 'pp' at virtual address 'va'. The permission (the low 12 bits) of the
  *   page table entry should be set to 'perm | PTE_C_CACHEABLE | PTE_V'.
@@ -249,6 +524,9 @@ int page_insert(Pde *pde_base, u_int asid, struct Page *page_pointer,
                 u_long virtual_address, u_int perm) {
   Pte *pte;
 
+  // 写入的页表不能与其他进程共享
+  try(pgtable_unshare(pde_base, asid, virtual_address));
+
   // 查找 virtual_address 是否存在原有的页表映射关系
   pgdir_walk(pde_base, virtual_address, 0, &pte);
 
@@ -327,15 +605,22 @@ void page_decref(struct Page *pp) {
 /* Lab 2 Key Code "page_remove" */
 // Overview:
 //   Unmap the physical page at virtual address 'virtual_address'.
+//
+// Post-Condition:
+//   Return 0 on success (or if nothing is mapped), or -E_NO_MEM if the page table is shared and
+//   there is no memory to copy it (see 'pgtable_unshare'); the mapping is kept then.
 // 删除原有的虚拟地址-物理地址映射关系
-void page_remove(Pde *pgdir, u_int asid, u_long virtual_address) {
+int page_remove(Pde *pgdir, u_int asid, u_long virtual_address) {
   Pte *pte;
 
   // 查找虚拟地址对应的 二级页表 和 页控制块
   struct Page *page_pointer = page_lookup(pgdir, virtual_address, &pte);
   if (page_pointer == NULL) {
-    return;
+    return 0;
   }
+  // 写入的页表不能与其他进程共享，复制后重新查找页表项
+  try(pgtable_unshare(pgdir, asid, virtual_address));
+  page_lookup(pgdir, virtual_address, &pte);
 
   // 删除页表映射：将页控制块映射的地址从原有虚拟地址变为0
   *pte = 0;
@@ -344,13 +629,14 @@ void page_remove(Pde *pgdir, u_int asid, u_long virtual_address) {
 
   // 因为对页表进行了修改，需要调用 tlb_invalidate 确保 TLB 中不保留原有内容。
   tlb_invalidate(asid, virtual_address);
-  return;
+  return 0;
 }
 /* End of Key Code "page_remove" */
 
 void physical_memory_manage_check(void) {
   struct Page *pp, *pp0, *pp1, *pp2;
   struct Page_list fl;
+  struct Page_list buddy_fl[BUDDY_MAX_ORDER + 1];
   int *temp;
 
   // should be able to allocate three pages
@@ -367,6 +653,7 @@ void physical_memory_manage_check(void) {
   fl = page_free_list;
   // now this page_free list must be empty!!!!
   LIST_INIT(&page_free_list);
+  buddy_steal(buddy_fl);
   // should be no free memory
   assert(page_alloc(&pp) == -E_NO_MEM);
 
@@ -387,6 +674,7 @@ void physical_memory_manage_check(void) {
   assert(*temp == 0);
 
   page_free_list = fl;
+  buddy_restore(buddy_fl);
   page_free(pp0);
   page_free(pp1);
   page_free(pp2);
@@ -436,6 +724,7 @@ void physical_memory_manage_check(void) {
 void page_check(void) {
   struct Page *pp, *pp0, *pp1, *pp2;
   struct Page_list fl;
+  struct Page_list buddy_fl[BUDDY_MAX_ORDER + 1];
 
   // should be able to allocate a page for directory
   assert(page_alloc(&pp) == 0);
@@ -455,6 +744,7 @@ void page_check(void) {
   fl = page_free_list;
   // now this page_free list must be empty!!!!
   LIST_INIT(&page_free_list);
+  buddy_steal(buddy_fl);
 
   // should be no free memory
   assert(page_alloc(&pp) == -E_NO_MEM);
@@ -539,6 +829,7 @@ void page_check(void) {
 
   // give free list back
   page_free_list = fl;
+  buddy_restore(buddy_fl);
 
   // free the pages we took
   page_free(pp0);
@@ -548,3 +839,60 @@ void page_check(void) {
 
   printk("page_check() succeeded!\n");
 }
+
+// 统计伙伴系统中空闲页的总数
+static u_long buddy_free_pages(void) {
+  u_long count = 0;
+  struct Page *pp;
+  for (u_int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+    LIST_FOREACH (pp, &buddy_free_area[order], pp_link) {
+      count += 1UL << order;
+    }
+  }
+  return count;
+}
+
+void buddy_check(void) {
+  struct Page *pp, *pp0, *pp1, *pp2;
+  u_long free_before = buddy_free_pages();
+  u_long top_before = 0;
+  LIST_FOREACH (pp, &buddy_free_area[BUDDY_MAX_ORDER], pp_link) {
+    top_before++;
+  }
+
+  // order out of range
+  assert(pages_alloc(&pp, BUDDY_MAX_ORDER + 1) == -E_INVAL);
+
+  // an order-3 block should be aligned to 8 pages and zeroed
+  assert(pages_alloc(&pp0, 3) == 0);
+  assert((page2ppn(pp0) & 7) == 0);
+  assert(page2ppn(pp0) >= buddy_start);
+  for (u_long *p = (u_long *)page2kva(pp0); p < (u_long *)page2kva(pp0 + 8); p++) {
+    assert(*p == 0);
+  }
+  *(int *)page2kva(pp0) = 1000;
+
+  // single pages must not overlap the block
+  assert(pages_alloc(&pp1, 0) == 0);
+  assert(pages_alloc(&pp2, 0) == 0);
+  assert(pp1 != pp2);
+  assert(pp1 < pp0 || pp1 >= pp0 + 8);
+  assert(pp2 < pp0 || pp2 >= pp0 + 8);
+  assert(buddy_free_pages() == free_before - 10);
+
+  // single buddy pages go back through page_free
+  pp1->pp_ref = 0;
+  page_free(pp1);
+  pages_free(pp2, 0);
+  pages_free(pp0, 3);
+
+  // everything should coalesce back
+  assert(buddy_free_pages() == free_before);
+  u_long top_after = 0;
+  LIST_FOREACH (pp, &buddy_free_area[BUDDY_MAX_ORDER], pp_link) {
+    top_after++;
+  }
+  assert(top_after == top_before);
+
+  printk("buddy_check() succeeded!\n");
+}
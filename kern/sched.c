@@ -1,49 +1,170 @@
 #include <env.h>
+#include <ide.h>
 #include <pmap.h>
 #include <printk.h>
+#include <sched.h>
+
+// 多级反馈队列调度
+// - 所有就绪进程仍在 env_sched_list 中，每个进程的级别记录在 env_sched_level 中
+// - 调度时选择级别最小（优先级最高）的进程，同一级别内按在队列中的先后轮转
+// - 进程在第 level 级一次获得 env_pri * (level + 1) 个时间片，剩余量记录在 env_slice_left 中
+// - 用完时间片的进程降一级，时间片未用完就阻塞的进程升一级
+// - 每 MLFQ_BOOST_TICKS 个时钟中断将所有就绪进程提升回第 0 级
+
+// 进程在当前级别中一次获得的时间片数
+static inline int mlfq_quantum(struct Env *env) {
+  return env->env_pri * (env->env_sched_level + 1);
+}
+
+/* Overview:
+ *   Find the runnable env of the highest priority (lowest level); among envs of the same level,
+ *   the one closest to the head of 'env_sched_list' wins. 'skip' is chosen only if it is the only
+ *   runnable env.
+ */
+static struct Env *mlfq_pick(struct Env *skip) {
+  struct Env *env, *best = NULL;
+  TAILQ_FOREACH (env, &env_sched_list, env_sched_link) {
+    if (env == skip) {
+      continue;
+    }
+    if (best == NULL || env->env_sched_level < best->env_sched_level) {
+      best = env;
+      if (best->env_sched_level == 0) {
+        break;
+      }
+    }
+  }
+  return best ? best : skip;
+}
+
+// 是否存在比 env 优先级更高的就绪进程
+static int mlfq_has_higher(struct Env *env) {
+  struct Env *other;
+  TAILQ_FOREACH (other, &env_sched_list, env_sched_link) {
+    if (other->env_sched_level < env->env_sched_level) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// 将所有就绪进程提升回最高优先级
+static void mlfq_boost(void) {
+  struct Env *env;
+  TAILQ_FOREACH (env, &env_sched_list, env_sched_link) {
+    env->env_sched_level = 0;
+  }
+}
 
 /* Overview:
- *   Implement a round-robin scheduling to select a runnable env and schedule it using 'env_run'.
+ *   Multi-level feedback queue scheduling: select a runnable env and schedule it using 'env_run'.
  *
  * Post-Condition:
  *   If 'yield' is set (non-zero), 'curenv' should not be scheduled again unless it is the only
  *   runnable env.
  */
 // 参数表示是否强制让出当前进程的运行
-// - yield为1时：此时当前进程必须让出
-// - count减为0时：此时分给进程的时间片被用完，将执行权让给其他进程
+// - yield为1时：此时当前进程必须让出，保持其级别与剩余时间片，移到队尾
+// - 时间片用完时：降低一级，将执行权让给其他进程
+// - 有更高优先级的进程就绪时：抢占当前进程
 // - 无当前进程：这必然是内核刚刚完成初始化，第一次产生时钟中断的情况，需要分配一个进程执行
-// - 进程状态不是可运行：当前进程不能再继续执行，让给其他进程
+// - 进程状态不是可运行：当前进程被阻塞，若时间片未用完则提升一级
 void schedule(int yield) {
-  // 时间片长度被量化为 N*TIMER_INTERVAL。
-  // N就是进程的优先级，通过count追踪当前进程还可以执行的时间片长度
-  static int count = 0;
+  // 时钟中断的计数，用于周期性提升
+  static u_int ticks = 0;
   struct Env *env = curenv;
 
-  // 是否需要切换进程
-  if (yield ||        // 强制切换：通过参数
-      count <= 0 ||   // 当前进程分配时间片结束
-      env == NULL ||  // 当前无进程：刚初始化，切换一次进行分配
-      env->env_status != ENV_RUNNABLE) {  // 当前进程被阻塞
-    if (env!=NULL) {
-      // 从调度队列中移除当前进程
-      TAILQ_REMOVE(&env_sched_list, env, env_sched_link);
-      // 如果之前的进程还是可运行的时，需要将其插入调度队列队尾，等待下一次轮到其执行
-      if (env->env_status == ENV_RUNNABLE) {
-        TAILQ_INSERT_TAIL(&env_sched_list, env, env_sched_link);
-      }
+  if (!yield && ++ticks >= MLFQ_BOOST_TICKS) {
+    ticks = 0;
+    mlfq_boost();
+  }
+#if !defined(LAB) || LAB >= 5
+  // 等待磁盘中断的进程超时后被唤醒
+  if (!yield) {
+    ide_tick();
+  }
+#endif
+
+  if (env != NULL && env->env_status == ENV_RUNNABLE) {
+    if (!yield && env->env_slice_left > 0 &&
+        (env->env_sched_level == 0 || !mlfq_has_higher(env))) {
+      // 时间片未用完，且没有更高优先级的进程，继续运行当前进程
+      env->env_slice_left--;
+      env_run(env);
+    }
+    // 用完时间片的CPU密集型进程降级
+    if (!yield && env->env_slice_left <= 0 && env->env_sched_level < MLFQ_NLEVEL - 1) {
+      env->env_sched_level++;
+    }
+    // 将当前进程移到调度队列队尾，等待下一次轮到其执行
+    TAILQ_REMOVE(&env_sched_list, env, env_sched_link);
+    TAILQ_INSERT_TAIL(&env_sched_list, env, env_sched_link);
+  } else if (env != NULL) {
+    // 当前进程已被阻塞（已经由阻塞它的代码移出调度队列）
+    // 在时间片用完之前就阻塞的I/O密集型进程升级
+    if (env->env_slice_left > 0 && env->env_sched_level > 0) {
+      env->env_sched_level--;
+    }
+    env->env_slice_left = 0;
+  }
+
+#if !defined(LAB) || LAB >= 5
+  // 所有进程都已阻塞，但有进程在等待磁盘：开中断等待磁盘中断将其唤醒
+  if (TAILQ_EMPTY(&env_sched_list)) {
+    ide_idle();
+  }
+#endif
+  // 当调度队列为空时，内核崩溃，因为操作系统中必须至少有一个进程
+  if (TAILQ_EMPTY(&env_sched_list)) {
+    panic("schedule: no runnable envs");
+  }
+  // 主动让出时，除非没有其他就绪进程，否则不再选中当前进程
+  struct Env *next = mlfq_pick((yield && env != NULL && env->env_status == ENV_RUNNABLE) ? env : NULL);
+
+  // 当前进程主动让出却没有其他可运行的进程：CPU 空闲，趁机补充预清零页池
+  if (yield && next == curenv) {
+    page_zero_refill(PAGE_ZERO_REFILL_BATCH);
+  }
+
+  // 上次的时间片已经用完（或刚被降级、升级），按所在级别分配新的时间片
+  if (next->env_slice_left <= 0) {
+    next->env_slice_left = mlfq_quantum(next);
+  }
+  next->env_slice_left--;
+  env_run(next);
+}
+
+/* Overview:
+ *   Switch from the blocked 'curenv' to 'next' directly, without searching 'env_sched_list'.
+ *   Used by IPC when 'curenv' has just woken 'next' up and waits for its answer: 'next' runs on
+ *   the rest of 'curenv''s time slice (or on a new quantum of its own if nothing is left).
+ *   Falls back to 'schedule(1)' if 'next' is not runnable.
+ */
+// 直接切换到指定的进程，并将当前进程剩余的时间片转交给它
+void schedule_handoff(struct Env *next) {
+  struct Env *env = curenv;
+  int left = 0;
+
+  if (next == NULL || next->env_status != ENV_RUNNABLE) {
+    schedule(1);
+  }
+
+  // 与 schedule 中当前进程被阻塞时的处理相同
+  if (env != NULL && env->env_status != ENV_RUNNABLE) {
+    if (env->env_slice_left > 0 && env->env_sched_level > 0) {
+      env->env_sched_level--;
     }
-    // 当调度队列为空时，内核崩溃，因为操作系统中必须至少有一个进程
-    if (TAILQ_EMPTY(&env_sched_list)) {
-      panic("schedule: no runnable envs");
+    left = env->env_slice_left;
+    env->env_slice_left = 0;
+  }
+
+  if (left > 0) {
+    next->env_slice_left = left;
+  } else {
+    if (next->env_slice_left <= 0) {
+      next->env_slice_left = mlfq_quantum(next);
     }
-    // 不要在这里使用 TAILQ_REMOVE
-    env = TAILQ_FIRST(&env_sched_list);
-    // 将剩余时间片更新为新的进程的优先级
-    count = env->env_pri;
+    next->env_slice_left--;
   }
-  // 无论是否进行切换，都将剩余时间片长度count减去1
-  // 然后调用env_run函数，继续运行当前进程curenv
-  count--;
-  env_run(env);
+  env_run(next);
 }
@@ -1,5 +1,8 @@
 #include <env.h>
+#include <ide.h>
 #include <io.h>
+#include <kmalloc.h>
+#include <malta.h>
 #include <mmu.h>
 #include <pmap.h>
 #include <printk.h>
@@ -9,6 +12,44 @@
 // 指向当前进程，在内核态
 extern struct Env *curenv;
 
+// 判断是否为正常用户空间虚拟地址，错误的话会返回真
+// 内联函数，不会修改栈帧
+static inline int is_illegal_va(u_long va) {
+  return (va < UTEMP) || (va >= UTOP);
+}
+
+static inline int is_illegal_va_range(u_long va, u_int len) {
+  if (len == 0) {
+    return 0;
+  }
+  return (va + len < va) || (va < UTEMP) || (va + len > UTOP);
+}
+
+/* Overview:
+ *   Check whether the kernel may not access the buffer ['va', 'va' + 'len') of 'curenv' directly:
+ *   it is not in user space, or it holds a page in the range of the pager of 'curenv' (see
+ *   'sys_set_pager') that is not mapped yet. Only the pager can fill such a page, in user mode,
+ *   so a system call reading or writing the buffer must fail before touching it.
+ */
+// 检查内核能否直接访问用户缓冲区：缺页处理函数负责但尚未填充的页面不能在内核中访问
+static int is_illegal_user_buf(u_long va, u_int len) {
+  if (is_illegal_va_range(va, len)) {
+    return 1;
+  }
+  if (len == 0 || curenv->env_user_pager_entry == 0) {
+    return 0;
+  }
+  // 只需检查缓冲区与 pager 负责的区间相交的页面
+  u_long start = MAX(va, curenv->env_pager_va);
+  u_long end = MIN(va + len, curenv->env_pager_va + curenv->env_pager_len);
+  for (u_long page_va = ROUNDDOWN(start, PAGE_SIZE); page_va < end; page_va += PAGE_SIZE) {
+    if (page_lookup(curenv->env_pgdir, page_va, NULL) == NULL) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 /* Overview:
  * 	This function is used to print a character on screen.
  *
@@ -29,7 +70,8 @@ void sys_putchar(int c) {
  */
 // 打印一个字符串到终端，其实和sys_putchar一致，进行了一定的封装，带有字符串地址检查
 int sys_print_cons(const void *s, u_int num) {
-  if (((u_int)s + num) > UTOP || ((u_int)s) >= UTOP || (s > s + num)) {
+  if (((u_int)s + num) > UTOP || ((u_int)s) >= UTOP || (s > s + num) ||
+      is_illegal_user_buf((u_long)s, num)) {
     return -E_INVAL;
   }
 
@@ -113,17 +155,33 @@ int sys_set_tlb_mod_entry(u_int envid, u_int func_address) {
 /* Overview:
  *   Check 'va' is illegal or not, according to include/mmu.h
  */
-// 判断是否为正常用户空间虚拟地址，错误的话会返回真
-// 内联函数，不会修改栈帧
-static inline int is_illegal_va(u_long va) {
-  return (va < UTEMP) || (va >= UTOP);
-}
+/* Overview:
+ *   Register the user space pager of 'envid': user mode accesses to unmapped pages in
+ *   ['va', 'va' + 'len') are passed to 'func' on the exception stack, like TLB Mod exceptions,
+ *   instead of being filled with zeroed pages by the kernel. 'func' being 0 removes the pager.
+ *
+ * Post-Condition:
+ *   Returns 0 on success.
+ *   Returns -E_INVAL if the range is not in user space, or covers the exception stack.
+ *   Returns the original error if underlying calls fail.
+ */
+// 注册进程的用户态缺页处理函数及其负责的地址区间
+int sys_set_pager(u_int envid, u_int func_address, u_int va, u_int len) {
+  struct Env *env;
 
-static inline int is_illegal_va_range(u_long va, u_int len) {
-  if (len == 0) {
-    return 0;
+  if (func_address != 0 && (len == 0 || is_illegal_va_range(va, len))) {
+    return -E_INVAL;
   }
-  return (va + len < va) || (va < UTEMP) || (va + len > UTOP);
+  // 内核在转入 pager 时写入异常处理栈，它不能由 pager 负责
+  if (func_address != 0 && va < UXSTACKTOP && va + len > UXSTACKTOP - PAGE_SIZE) {
+    return -E_INVAL;
+  }
+  try(envid2env(envid, &env, 1));
+  env->env_user_pager_entry = func_address;
+  env->env_pager_va = va;
+  env->env_pager_len = len;
+
+  return 0;
 }
 
 /* Overview:
@@ -189,7 +247,7 @@ int sys_mem_map(u_int src_envid, u_int src_virtual_address,
   try(envid2env(dst_envid, &dst_env, 1));
 
   // 获取需要被空闲的物理页面
-  page = page_lookup(src_env->env_pgdir, src_virtual_address, NULL);
+  page = env_page_lookup(src_env, src_virtual_address, NULL);
   if (page == NULL) {
     return -E_INVAL;
   }
@@ -219,9 +277,8 @@ int sys_mem_unmap(u_int envid, u_int virtual_address) {
   // 获取对应的进程控制块
   try(envid2env(envid, &env, 1));
 
-  // 删除映射关系
-  page_remove(env->env_pgdir, env->env_asid, virtual_address);
-  return 0;
+  // 删除映射关系，共享的页表无法复制时返回错误
+  return page_remove(env->env_pgdir, env->env_asid, virtual_address);
 }
 
 /* Overview:
@@ -252,6 +309,275 @@ int sys_exofork(void) {
   env->env_status = ENV_NOT_RUNNABLE;
   // 继承父进程的优先级
   env->env_pri = curenv->env_pri;
+  // 尚未加载的可执行文件页面由子进程按需加载
+  if ((env->env_image = curenv->env_image) != NULL) {
+    env->env_image->im_ref++;
+  }
+
+  return env->env_id;
+}
+
+/* Overview:
+ *   Share the pages of 'parent' below USTACKTOP with 'child'. Pages with 'PTE_D' but without
+ *   'PTE_LIBRARY' are marked 'PTE_COW' without 'PTE_D' in both envs; the others are mapped with
+ *   the same permission.
+ *   A page table covering 4 MB below USTACKTOP that maps no 'PTE_LIBRARY' page is not copied but
+ *   shared by both page directories, until one of them modifies it (see 'pgtable_unshare').
+ *   Page tables with 'PTE_LIBRARY' pages are copied, so that 'pp_ref' of shared pages (which
+ *   'pageref' relies on, e.g. for pipes) stays exact.
+ *
+ * Post-Condition:
+ *   Return 0 on success, or the original error if underlying calls fail. Return in '*cow' whether
+ *   some page of 'parent' has been made copy-on-write.
+ */
+// 复制父进程USTACKTOP之下的页表，将可写页面设置为写时复制
+static int fork_copy_pgdir(struct Env *parent, struct Env *child, int *cow) {
+  for (u_int pdx = 0; pdx <= PDX(USTACKTOP - 1); pdx++) {
+    // 跳过无效的页目录项，不必逐页检查
+    if (!(parent->env_pgdir[pdx] & PTE_V)) {
+      continue;
+    }
+    struct Page *table = pa2page(PTE_ADDR(parent->env_pgdir[pdx]));
+    Pte *pgtable = (Pte *)page2kva(table);
+    int has_library = 0;
+
+    // 已被共享的页表中没有可写页面，也没有PTE_LIBRARY页面，可以直接共享
+    if (table->pp_ref == 1) {
+      for (u_int ptx = 0; ptx < PAGE_SIZE / sizeof(Pte); ptx++) {
+        u_int va = (pdx << PDSHIFT) | (ptx << PGSHIFT);
+        Pte *pte = &pgtable[ptx];
+        if (va >= USTACKTOP) {
+          break;
+        }
+        if (!(*pte & PTE_V)) {
+          continue;
+        }
+        // 如果页面可写，且不是PTE_LIBRARY，则在父子进程中同时设置为写时复制
+        if (*pte & PTE_LIBRARY) {
+          has_library = 1;
+        } else if (*pte & PTE_D) {
+          *pte = (*pte & ~PTE_D) | PTE_COW;
+          *cow = 1;
+        }
+      }
+    }
+
+    // 整个4MB区域都在USTACKTOP之下，共享页表
+    if (!has_library && ((pdx + 1) << PDSHIFT) <= USTACKTOP) {
+      child->env_pgdir[pdx] = parent->env_pgdir[pdx];
+      table->pp_ref++;
+      continue;
+    }
+
+    // 否则逐页映射给子进程
+    for (u_int ptx = 0; ptx < PAGE_SIZE / sizeof(Pte); ptx++) {
+      u_int va = (pdx << PDSHIFT) | (ptx << PGSHIFT);
+      if (va >= USTACKTOP) {
+        break;
+      }
+      if (pgtable[ptx] & PTE_V) {
+        try(page_insert(child->env_pgdir, child->env_asid, pa2page(pgtable[ptx]), va,
+                        pgtable[ptx] & 0xfff));
+      }
+    }
+  }
+  return 0;
+}
+
+/* Overview:
+ *   Create a child of 'curenv' with a copy-on-write copy of its address space below USTACKTOP,
+ *   in one system call. The child is made runnable at once.
+ *
+ * Post-Condition:
+ *   The child starts from the same context as 'curenv' returning from this call, but with 0 as
+ *   the return value, and inherits 'env_pri', 'env_user_tlb_mod_entry' and the pager of 'curenv'.
+ *   Return the envid of the child to 'curenv'.
+ *   Return the original error if underlying calls fail; the child is freed in that case.
+ */
+// 在内核中实现fork，一次完成子进程地址空间的复制
+int sys_fork(void) {
+  struct Env *env;
+  int cow = 0;
+
+  try(env_alloc(&env, curenv->env_id));
+  env->env_tf = *((struct Trapframe *)KSTACKTOP - 1);
+  // 子进程的返回值为0
+  env->env_tf.regs[2] = 0;
+  env->env_status = ENV_NOT_RUNNABLE;
+  env->env_pri = curenv->env_pri;
+  env->env_user_tlb_mod_entry = curenv->env_user_tlb_mod_entry;
+  env->env_user_pager_entry = curenv->env_user_pager_entry;
+  env->env_pager_va = curenv->env_pager_va;
+  env->env_pager_len = curenv->env_pager_len;
+  // 尚未加载的可执行文件页面由子进程按需加载
+  if ((env->env_image = curenv->env_image) != NULL) {
+    env->env_image->im_ref++;
+  }
+
+  int func_info = fork_copy_pgdir(curenv, env, &cow);
+  // 父进程中被设为写时复制的页面，TLB中可能还有可写的旧表项
+  if (cow) {
+    tlb_flush_all();
+  }
+  if (func_info < 0) {
+    env_free(env);
+    return func_info;
+  }
+
+  // 复制完成，子进程可以被调度
+  env->env_status = ENV_RUNNABLE;
+  TAILQ_INSERT_TAIL(&env_sched_list, env, env_sched_link);
+
+  return env->env_id;
+}
+
+/* Overview:
+ *   Build the initial stack of the spawned env 'env' on a new page at USTACKTOP - PAGE_SIZE: the
+ *   strings of the NULL-terminated array 'argv' in the address space of 'curenv', the array of
+ *   pointers to them, and argv and argc on top, as '_start' in user/lib/entry.S expects.
+ *
+ * Post-Condition:
+ *   Return 0 and set '*sp' to the initial stack pointer of 'env' on success.
+ *   Return -E_INVAL if 'argv' or one of its strings is not in user space, -E_NO_MEM if they don't
+ *   fit in one page, or the original error if underlying calls fail.
+ */
+// 在内核中直接构造子进程的初始栈，无需经过UTEMP
+static int spawn_init_stack(struct Env *env, u_int argv, u_int *sp) {
+  u_int argc, tot = 0;
+
+  // 计算argc和所需的参数空间大小，同时检查参数位于用户空间中
+  for (argc = 0;; argc++) {
+    if (is_illegal_user_buf(argv + argc * sizeof(u_int), sizeof(u_int))) {
+      return -E_INVAL;
+    }
+    const char *str = ((const char **)argv)[argc];
+    if (str == NULL) {
+      break;
+    }
+    u_int len;
+    for (len = 0;; len++) {
+      if (is_illegal_user_buf((u_long)str + len, 1)) {
+        return -E_INVAL;
+      }
+      if (tot + len >= PAGE_SIZE) {
+        return -E_NO_MEM;
+      }
+      if (str[len] == '\0') {
+        break;
+      }
+    }
+    tot += len + 1;
+  }
+  if (ROUND(tot, 4) + 4 * (argc + 3) > PAGE_SIZE) {
+    return -E_NO_MEM;
+  }
+
+  // 申请栈页面，通过kseg0地址直接写入
+  struct Page *page;
+  try(page_alloc(&page));
+  u_long kva = page2kva(page);
+  // 将栈页面中的内核地址转换为子进程中的用户地址
+  u_long to_user = USTACKTOP - PAGE_SIZE - kva;
+
+  char *strings = (char *)(kva + PAGE_SIZE - tot);
+  u_int *args = (u_int *)(kva + PAGE_SIZE - ROUND(tot, 4) - 4 * (argc + 1));
+  for (u_int i = 0; i < argc; i++) {
+    const char *str = ((const char **)argv)[i];
+    u_int len = strlen(str) + 1;
+    memcpy(strings, str, len);
+    args[i] = (u_long)strings + to_user;
+    strings += len;
+  }
+  args[argc] = 0;
+  // argc和argv数组指针位于栈顶
+  args[-1] = (u_long)args + to_user;
+  args[-2] = argc;
+  *sp = (u_long)&args[-2] + to_user;
+
+  return page_insert(env->env_pgdir, env->env_asid, page, USTACKTOP - PAGE_SIZE, PTE_D);
+}
+
+/* Overview:
+ *   Map the 'PTE_LIBRARY' pages of 'parent' below USTACKTOP into 'child' at the same address with
+ *   the same permission.
+ */
+// 父子进程共享PTE_LIBRARY页面（如文件描述符）
+static int spawn_share_library(struct Env *parent, struct Env *child) {
+  for (u_int pdx = 0; pdx <= PDX(USTACKTOP - 1); pdx++) {
+    if (!(parent->env_pgdir[pdx] & PTE_V)) {
+      continue;
+    }
+    Pte *pgtable = (Pte *)KADDR(PTE_ADDR(parent->env_pgdir[pdx]));
+    for (u_int ptx = 0; ptx < PAGE_SIZE / sizeof(Pte); ptx++) {
+      u_int va = (pdx << PDSHIFT) | (ptx << PGSHIFT);
+      if (va >= USTACKTOP) {
+        break;
+      }
+      Pte pte = pgtable[ptx];
+      if ((pte & PTE_V) && (pte & PTE_LIBRARY)) {
+        try(page_insert(child->env_pgdir, child->env_asid, pa2page(pte), va, pte & 0xfff));
+      }
+    }
+  }
+  return 0;
+}
+
+/* Overview:
+ *   Create a child of 'curenv' running the ELF executable mapped at 'binary' (for example the file
+ *   pages shared by the file server) of 'size' bytes in the address space of 'curenv', with the
+ *   NULL-terminated argument array 'argv'. The segments and the initial stack are built by the
+ *   kernel directly in the child, and the 'PTE_LIBRARY' pages of 'curenv' are shared with it.
+ *   If 'binary' is page-aligned, the segments are loaded lazily on first access (see
+ *   'icode_fault'). Whole read-only pages of the segments are mapped from the pages of 'binary'
+ *   without 'PTE_D' instead of being copied, so children running the same file share its text.
+ *   The child is made runnable at once.
+ *
+ * Post-Condition:
+ *   Return the envid of the child on success.
+ *   Return -E_INVAL if the pages of 'binary' are not all mapped in 'curenv' or 'argv' is illegal,
+ *   -E_NOT_EXEC if 'binary' is not a valid executable, or the original error if underlying calls
+ *   fail; the child is freed in that case.
+ *
+ * Note:
+ *   Like 'load_icode', this does no D-cache/I-cache writeback and invalidation after loading code.
+ */
+// 在内核中完成spawn：加载ELF文件的各个段、构造参数栈、共享PTE_LIBRARY页面
+int sys_spawn(u_int binary, u_int size, u_int argv) {
+  struct Env *env;
+  int func_info;
+  u_int sp;
+
+  if (size == 0 || is_illegal_va_range(binary, size)) {
+    return -E_INVAL;
+  }
+  // 文件内容需要已经映射在调用者的地址空间中，避免读取时缺页
+  for (u_int va = ROUNDDOWN(binary, PAGE_SIZE); va < binary + size; va += PAGE_SIZE) {
+    if (env_page_lookup(curenv, va, NULL) == NULL) {
+      return -E_INVAL;
+    }
+  }
+
+  try(env_alloc(&env, curenv->env_id));
+  env->env_status = ENV_NOT_RUNNABLE;
+  env->env_pri = curenv->env_pri;
+
+  // 文件页对齐时（如文件描述符的数据区）按需加载，否则立即加载
+  if (binary % PAGE_SIZE == 0) {
+    func_info = env_load_icode_lazy(env, (const void *)binary, size, curenv->env_pgdir);
+  } else {
+    func_info = env_load_icode(env, (const void *)binary, size, curenv->env_pgdir);
+  }
+  if (func_info < 0 ||
+      (func_info = spawn_init_stack(env, argv, &sp)) < 0 ||
+      (func_info = spawn_share_library(curenv, env)) < 0) {
+    env_free(env);
+    return func_info;
+  }
+  env->env_tf.regs[29] = sp;
+
+  // 加载完成，子进程可以被调度
+  env->env_status = ENV_RUNNABLE;
+  TAILQ_INSERT_TAIL(&env_sched_list, env, env_sched_link);
 
   return env->env_id;
 }
@@ -304,7 +630,7 @@ int sys_set_env_status(u_int envid, u_int status) {
 // 当从该系统调用返回时，将返回设置的栈帧中epc的位置
 int sys_set_trapframe(u_int envid, struct Trapframe *tf) {
   // 检查地址是否合法
-  if (is_illegal_va_range((u_long)tf, sizeof *tf)) {
+  if (is_illegal_user_buf((u_long)tf, sizeof *tf)) {
     return -E_INVAL;
   }
 
@@ -339,8 +665,197 @@ void sys_panic(char *msg) {
 }
 
 /* Overview:
- *   Wait for a message (a value, together with a page if 'dst_virtual_address' is not 0) from other envs.
- *   'curenv' is blocked until a message is sent.
+ *   Check that every page in the 'nseg' segments 'segs' is mapped in 'sender'.
+ *
+ * Post-Condition:
+ *   Return the total number of pages in the segments, or -E_INVAL if some page is not mapped.
+ */
+// 检查发送方共享的页面都已经映射，返回页面总数
+static int ipc_segs_lookup(struct Env *sender, const struct Ipc_seg *segs, u_int nseg) {
+  int npages = 0;
+  for (u_int i = 0; i < nseg; i++) {
+    for (u_int j = 0; j < segs[i].is_npages; j++) {
+      if (env_page_lookup(sender, segs[i].is_va + j * PAGE_SIZE, NULL) == NULL) {
+        return -E_INVAL;
+      }
+    }
+    npages += segs[i].is_npages;
+  }
+  return npages;
+}
+
+/* Overview:
+ *   Deliver a message from 'sender' to 'receiver', which is waiting in 'sys_ipc_recv'.
+ *   The pages of the segments 'segs' mapped in 'sender' are mapped one after another from the
+ *   receiver's 'env_ipc_dstva', each with the permission of its segment.
+ *
+ * Post-Condition:
+ *   Return 0 on success, and the receiver's 'env_ipc_*' fields are updated with 'env_ipc_recving'
+ *   cleared. The receiver is NOT made runnable here.
+ *   Return -E_INVAL if some page is not mapped in 'sender', or there are more pages than the
+ *   receiver accepts. Return the original error when underlying calls fail. The receiver's
+ *   'env_ipc_*' fields are left untouched in these cases.
+ */
+// 完成一次消息的传递：将值和共享页面交给正在接收的进程
+static int ipc_deliver(struct Env *sender, struct Env *receiver, u_int value_send,
+                       const struct Ipc_seg *segs, u_int nseg) {
+  int npages;
+  // 解码接收方的接收地址与最多接收的页面数
+  u_int dst_va = ROUNDDOWN(receiver->env_ipc_dstva, PAGE_SIZE);
+  u_int dst_npages = (receiver->env_ipc_dstva & (PAGE_SIZE - 1)) + 1;
+
+  // 先检查所有页面，再建立映射
+  if ((npages = ipc_segs_lookup(sender, segs, nseg)) < 0) {
+    return npages;
+  }
+  if ((u_int)npages > dst_npages) {
+    return -E_INVAL;
+  }
+
+  // 将发送进程的页面共享到接收进程，通过这些页面获得发送进程发送的一些信息。
+  u_int va = dst_va;
+  for (u_int i = 0; i < nseg; i++) {
+    for (u_int j = 0; j < segs[i].is_npages; j++) {
+      // 获取 共享虚拟地址对应的 物理页面控制块
+      struct Page *page_shared = page_lookup(sender->env_pgdir, segs[i].is_va + j * PAGE_SIZE, NULL);
+      // 在接受进程中建立映射关系
+      int func_info = page_insert(receiver->env_pgdir, receiver->env_asid, page_shared, va,
+                                  segs[i].is_perm);
+      if (func_info < 0) {
+        // 撤销已经建立的映射
+        for (; va > dst_va; va -= PAGE_SIZE) {
+          page_remove(receiver->env_pgdir, receiver->env_asid, va - PAGE_SIZE);
+        }
+        return func_info;
+      }
+      va += PAGE_SIZE;
+    }
+  }
+
+  // 设置接收进程的相关属性
+  // 直接接受到的值
+  receiver->env_ipc_value = value_send;
+  // 接受进程记录发送进程的envid
+  receiver->env_ipc_from = sender->env_id;
+  // 接受方对共享页面的权限操作
+  receiver->env_ipc_perm = PTE_V | (nseg > 0 ? segs[0].is_perm : 0);
+  receiver->env_ipc_npages = npages;
+  // 置0表示接受到信息
+  receiver->env_ipc_recving = 0;
+
+  return 0;
+}
+
+/* Overview:
+ *   Copy 'nseg' segments from the user array 'user_segs' into 'segs', checking the addresses.
+ *
+ * Post-Condition:
+ *   Return 0 on success, or -E_INVAL if 'nseg' exceeds IPC_SEG_MAX or an address is illegal.
+ */
+// 从用户空间复制消息片段，并检查地址是否合法
+static int ipc_segs_copyin(struct Ipc_seg *segs, u_int user_segs, u_int nseg) {
+  if (nseg > IPC_SEG_MAX || is_illegal_user_buf(user_segs, nseg * sizeof(struct Ipc_seg))) {
+    return -E_INVAL;
+  }
+  memcpy(segs, (void *)user_segs, nseg * sizeof(struct Ipc_seg));
+
+  for (u_int i = 0; i < nseg; i++) {
+    if (segs[i].is_npages > PAGE_SIZE ||
+        is_illegal_va_range(segs[i].is_va, segs[i].is_npages * PAGE_SIZE)) {
+      return -E_INVAL;
+    }
+  }
+  return 0;
+}
+
+// 检查接收地址是否合法
+static inline int ipc_illegal_dstva(u_int dst_virtual_address) {
+  u_int npages = (dst_virtual_address & (PAGE_SIZE - 1)) + 1;
+  return dst_virtual_address != 0 &&
+         is_illegal_va_range(ROUNDDOWN(dst_virtual_address, PAGE_SIZE), npages * PAGE_SIZE);
+}
+
+// 将进程设为可运行并加入调度队列
+static void ipc_wakeup(struct Env *env) {
+  env->env_status = ENV_RUNNABLE;
+  TAILQ_INSERT_TAIL(&env_sched_list, env, env_sched_link);
+}
+
+/* Overview:
+ *   Save the message of 'curenv' and queue it on 'target''s 'env_ipc_senders'. 'curenv' is not
+ *   blocked here.
+ *
+ * Post-Condition:
+ *   Return 0 on success, -E_INVAL if some page is not mapped in 'curenv', or -E_NO_MEM if the
+ *   segments cannot be saved.
+ */
+// 保存待发送的消息，加入接收方的等待队列
+static int ipc_queue(struct Env *target, u_int value_send, const struct Ipc_seg *segs,
+                     u_int nseg) {
+  // 共享的页面在阻塞前就检查，尽早报告错误
+  try(ipc_segs_lookup(curenv, segs, nseg));
+
+  if (nseg <= 1) {
+    curenv->env_ipc_send_segs = &curenv->env_ipc_send_seg;
+  } else if ((curenv->env_ipc_send_segs = kmalloc(nseg * sizeof(struct Ipc_seg))) == NULL) {
+    return -E_NO_MEM;
+  }
+  memcpy(curenv->env_ipc_send_segs, segs, nseg * sizeof(struct Ipc_seg));
+  curenv->env_ipc_send_nseg = nseg;
+  curenv->env_ipc_send_value = value_send;
+  curenv->env_ipc_send_to = target;
+  TAILQ_INSERT_TAIL(&target->env_ipc_senders, curenv, env_ipc_send_link);
+  return 0;
+}
+
+/* Overview:
+ *   Take the first message queued on 'receiver', which must be in the receiving state.
+ *   A sender blocked in 'sys_ipc_send' is woken up with the result of the delivery. A sender
+ *   blocked in 'sys_ipc_call' stays blocked instead: it enters the receiving state to wait for
+ *   the reply, and takes a message queued on itself, if any, in the same way.
+ *
+ * Post-Condition:
+ *   Return 1 if a message has been delivered to 'receiver', 0 if no (deliverable) message is
+ *   queued.
+ */
+// 从接收方的等待队列中取出一条消息
+static int ipc_take_queued(struct Env *receiver) {
+  struct Env *sender;
+
+  while ((sender = TAILQ_FIRST(&receiver->env_ipc_senders)) != NULL) {
+    TAILQ_REMOVE(&receiver->env_ipc_senders, sender, env_ipc_send_link);
+    sender->env_ipc_send_to = NULL;
+
+    int func_info = ipc_deliver(sender, receiver, sender->env_ipc_send_value,
+                                sender->env_ipc_send_segs, sender->env_ipc_send_nseg);
+    env_ipc_release_segs(sender);
+    if (func_info == 0 && sender->env_ipc_calling) {
+      // 请求已被取走，调用方转入接收态等待回复，其 env_ipc_dstva 在调用时已经设置
+      sender->env_ipc_calling = 0;
+      sender->env_ipc_recving = 1;
+      if (ipc_take_queued(sender)) {
+        ipc_wakeup(sender);
+      }
+      return 1;
+    }
+    // 唤醒发送方，其系统调用的返回值即为本次传递的结果
+    sender->env_ipc_calling = 0;
+    sender->env_tf.regs[2] = func_info;
+    ipc_wakeup(sender);
+    if (func_info == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Overview:
+ *   Wait for a message (a value, together with pages if 'dst_virtual_address' is not 0) from other envs.
+ *   'dst_virtual_address' is made by IPC_RECV_VA: the received pages are mapped one after another
+ *   from the page-aligned address, and at most the number of pages encoded in the page offset
+ *   are accepted (a plain address accepts one page).
+ *   If some envs are already blocked in 'sys_ipc_send' or 'sys_ipc_call' to 'curenv', the message
+ *   of the first one is taken at once. Otherwise 'curenv' is blocked until a message is sent.
  *
  * Post-Condition:
  *   Return 0 on success.
@@ -350,7 +865,7 @@ void sys_panic(char *msg) {
 // 设置相应的握手信号，并将自身进程阻塞，等待发送进程发送完成
 int sys_ipc_recv(u_int dst_virtual_address) {
   // 检查地址是否合法
-  if (dst_virtual_address != 0 && is_illegal_va(dst_virtual_address)) {
+  if (ipc_illegal_dstva(dst_virtual_address)) {
     return -E_INVAL;
   }
 
@@ -359,6 +874,12 @@ int sys_ipc_recv(u_int dst_virtual_address) {
   curenv->env_ipc_recving = 1;
   // 表明自己要将接受到的页面与dst_va成映射
   curenv->env_ipc_dstva= dst_virtual_address;
+
+  // 已有发送方在等待：直接取走队首发送方的消息，不必阻塞和调度
+  if (ipc_take_queued(curenv)) {
+    return 0;
+  }
+
   // 阻塞当前进程，等待对方进程发送数据
   // 阻塞的实现：直接移出调度队列，等待持有锁的资源手动调度阻塞进程
   curenv->env_status = ENV_NOT_RUNNABLE;
@@ -396,7 +917,8 @@ int sys_ipc_try_send(
   u_int permission      // 接受方得到的 共享的内存的权限
   ) {
   struct Env *env_receive;
-  struct Page *page_shared;
+  // 如果为0表示只传值，不用共享页面
+  struct Ipc_seg seg = {src_virtual_address, src_virtual_address != 0, permission};
 
   // 检查地址是否合法
   if (src_virtual_address != 0 && is_illegal_va(src_virtual_address)) {
@@ -412,43 +934,232 @@ int sys_ipc_try_send(
     return -E_IPC_NOT_RECV;
   }
 
-  // 设置接收进程的相关属性
-  // 直接接受到的值
-  env_receive->env_ipc_value = value_send;
-  // 接受进程记录发送进程的envid
-  env_receive->env_ipc_from = curenv->env_id;
-  // 接受方对共享页面的权限操作
-  env_receive->env_ipc_perm = PTE_V | permission;
-  // 置0表示接受到信息
-  env_receive->env_ipc_recving = 0;
-
-  // 如果为0表示只传值，不用共享页面
-  // 将当前进程的一个页面共享到接收进程，通过该页面获得发送进程发送的一些信息。
-  if (src_virtual_address != 0) {
-    // 获取 共享虚拟地址对应的 物理页面控制块
-    page_shared = page_lookup(curenv->env_pgdir, src_virtual_address, NULL);
-    if (page_shared == NULL) {
-      return -E_INVAL;
-    }
-
-    // 在接受进程中建立映射关系
-    try(page_insert(
-          env_receive->env_pgdir, // 接受进程的页目录
-          env_receive->env_asid,  // 接受进程的asid
-          page_shared,            // 共享的物理页面控制块
-          env_receive->env_ipc_dstva, // 接受到的页面 映射到 接收进程的虚拟地址
-          permission              // 接受方得到的 共享的内存的权限
-        ));
-  }
+  try(ipc_deliver(curenv, env_receive, value_send, &seg, 1));
 
   // 接收到了信息，取消接收进程的阻塞状态
-  env_receive->env_status = ENV_RUNNABLE;
   // 如果进程被阻塞了，则不管，直到别的进程将被阻塞进程重新移入调度队列中
-  TAILQ_INSERT_TAIL(&env_sched_list, env_receive, env_sched_link);
+  ipc_wakeup(env_receive);
 
   return 0;
 }
 
+/* Overview:
+ *   Send a 'value' together with the pages of the segments 'segs' to the target env 'envid',
+ *   blocking until it is received.
+ *   If the target is waiting in 'sys_ipc_recv', the message is delivered at once. Otherwise
+ *   'curenv' leaves 'env_sched_list' and waits on the target's 'env_ipc_senders' queue; the
+ *   target takes the message in its next 'sys_ipc_recv'.
+ *
+ * Post-Condition:
+ *   Return 0 once the message is delivered.
+ *   Return -E_INVAL if no page is mapped at some address of the segments, the target accepts
+ *   fewer pages, or the target is 'curenv' itself.
+ *   Return -E_BAD_ENV if the target does not exist or is destroyed before receiving.
+ *   Return the original error when underlying calls fail.
+ */
+// 阻塞发送一条消息
+static int ipc_send(u_int envid_receive, u_int value_send, const struct Ipc_seg *segs,
+                    u_int nseg) {
+  struct Env *env_receive;
+
+  try(envid2env(envid_receive, &env_receive, 0));
+  // 向自己阻塞发送永远无法完成
+  if (env_receive == curenv) {
+    return -E_INVAL;
+  }
+
+  // 接收方正在等待，直接完成传递
+  if (env_receive->env_ipc_recving) {
+    try(ipc_deliver(curenv, env_receive, value_send, segs, nseg));
+    ipc_wakeup(env_receive);
+    return 0;
+  }
+
+  // 保存消息，在接收方的等待队列中阻塞
+  try(ipc_queue(env_receive, value_send, segs, nseg));
+
+  curenv->env_status = ENV_NOT_RUNNABLE;
+  TAILQ_REMOVE(&env_sched_list, curenv, env_sched_link);
+
+  // 默认返回值为 0，若传递失败，接收方会在唤醒时改写
+  ((struct Trapframe *)KSTACKTOP - 1)->regs[2] = 0;
+
+  schedule(1);
+}
+
+/* Overview:
+ *   Send a 'value' (together with a page if 'src_virtual_address' is not 0) to the target env
+ *   'envid', blocking until it is received. See 'ipc_send'.
+ */
+// 进程间通信阻塞发送信息
+int sys_ipc_send(u_int envid_receive, u_int value_send, u_int src_virtual_address,
+                 u_int permission) {
+  struct Ipc_seg seg = {src_virtual_address, src_virtual_address != 0, permission};
+
+  // 检查地址是否合法
+  if (src_virtual_address != 0 && is_illegal_va(src_virtual_address)) {
+    return -E_INVAL;
+  }
+
+  return ipc_send(envid_receive, value_send, &seg, 1);
+}
+
+/* Overview:
+ *   Send a 'value' together with the pages of 'nseg' segments (an array of struct Ipc_seg at
+ *   'segs' in the user space) to the target env 'envid', blocking until it is received. See
+ *   'ipc_send'. The pages are mapped one after another in the receiver.
+ *
+ * Post-Condition:
+ *   Return -E_INVAL if 'nseg' exceeds IPC_SEG_MAX or an address is illegal; otherwise the same as
+ *   'ipc_send'.
+ */
+// 进程间通信阻塞发送多个页面
+int sys_ipc_sendv(u_int envid_receive, u_int value_send, u_int segs, u_int nseg) {
+  struct Ipc_seg kern_segs[IPC_SEG_MAX];
+
+  try(ipc_segs_copyin(kern_segs, segs, nseg));
+
+  return ipc_send(envid_receive, value_send, kern_segs, nseg);
+}
+
+/* Overview:
+ *   Send a message to 'target' and then wait for a message into 'dst_virtual_address', as
+ *   'sys_ipc_send' followed by 'sys_ipc_recv' would, but in a single kernel entry.
+ *   If 'target' is waiting, the message is delivered at once and the CPU is handed over to it
+ *   directly together with the rest of 'curenv''s time slice. Otherwise 'curenv' is queued on
+ *   'target' and enters the receiving state when its message is taken.
+ *   A NULL 'target' only waits for a message.
+ *
+ * Post-Condition:
+ *   Return 0 once a message has been received.
+ *   Return -E_BAD_ENV if 'target' is destroyed before taking the message.
+ *   Return the original error when the delivery fails; nothing is received in that case.
+ */
+// 发送后立即转入接收态，等待对方的回复
+static int ipc_send_recv(struct Env *target, u_int value_send, const struct Ipc_seg *segs,
+                         u_int nseg, u_int dst_virtual_address) {
+  if (target != NULL && target->env_ipc_recving) {
+    // 对方正在等待，直接完成传递
+    try(ipc_deliver(curenv, target, value_send, segs, nseg));
+    ipc_wakeup(target);
+  } else if (target != NULL) {
+    // 在对方的等待队列中阻塞，消息被取走后由 ipc_take_queued 转入接收态
+    try(ipc_queue(target, value_send, segs, nseg));
+    curenv->env_ipc_calling = 1;
+    curenv->env_ipc_dstva = dst_virtual_address;
+
+    curenv->env_status = ENV_NOT_RUNNABLE;
+    TAILQ_REMOVE(&env_sched_list, curenv, env_sched_link);
+    ((struct Trapframe *)KSTACKTOP - 1)->regs[2] = 0;
+    schedule(1);
+  }
+
+  // 消息已经送达，转入接收态
+  curenv->env_ipc_recving = 1;
+  curenv->env_ipc_dstva = dst_virtual_address;
+  if (ipc_take_queued(curenv)) {
+    return 0;
+  }
+
+  curenv->env_status = ENV_NOT_RUNNABLE;
+  TAILQ_REMOVE(&env_sched_list, curenv, env_sched_link);
+  ((struct Trapframe *)KSTACKTOP - 1)->regs[2] = 0;
+
+  // 直接切换到刚被唤醒的对方，不经过调度队列的查找
+  if (target != NULL) {
+    schedule_handoff(target);
+  }
+  schedule(1);
+}
+
+/* Overview:
+ *   Send a request to 'envid' and wait for the reply in one system call. The reply is received
+ *   like 'sys_ipc_recv(dst_virtual_address)'.
+ *
+ * Post-Condition:
+ *   Return 0 once the reply has been received.
+ *   Return -E_INVAL if an address is illegal, no page is mapped at 'src_virtual_address', or the
+ *   target is 'curenv' itself.
+ *   Return -E_BAD_ENV if the target does not exist or is destroyed before taking the request.
+ *   Return the original error when underlying calls fail.
+ */
+// 进程间通信调用：发送请求并等待回复
+int sys_ipc_call(u_int envid_receive, u_int value_send, u_int src_virtual_address,
+                 u_int permission, u_int dst_virtual_address) {
+  struct Env *env_receive;
+  struct Ipc_seg seg = {src_virtual_address, src_virtual_address != 0, permission};
+
+  // 检查地址是否合法
+  if (src_virtual_address != 0 && is_illegal_va(src_virtual_address)) {
+    return -E_INVAL;
+  }
+  if (ipc_illegal_dstva(dst_virtual_address)) {
+    return -E_INVAL;
+  }
+
+  try(envid2env(envid_receive, &env_receive, 0));
+  if (env_receive == curenv) {
+    return -E_INVAL;
+  }
+
+  return ipc_send_recv(env_receive, value_send, &seg, 1, dst_virtual_address);
+}
+
+/* Overview:
+ *   Reply to the client 'envid' with the pages of 'nseg' segments (an array of struct Ipc_seg at
+ *   'segs' in the user space), and wait for the next request in one system call, for servers
+ *   answering 'sys_ipc_call'. If 'envid' is 0, or the client no longer exists, no reply is sent
+ *   and this behaves like 'sys_ipc_recv(dst_virtual_address)'.
+ *
+ * Post-Condition:
+ *   Return 0 once the next request has been received.
+ *   Return -E_INVAL if an address is illegal, 'nseg' exceeds IPC_SEG_MAX, or some page of the
+ *   segments is not mapped.
+ *   Return the original error when underlying calls fail.
+ */
+// 服务进程回复上一个请求，并等待下一个请求
+static int ipc_reply_wait(u_int envid_reply, u_int value_send, const struct Ipc_seg *segs,
+                          u_int nseg, u_int dst_virtual_address) {
+  struct Env *env_reply = NULL;
+
+  if (ipc_illegal_dstva(dst_virtual_address)) {
+    return -E_INVAL;
+  }
+
+  // 客户进程已经退出：回复无人接收，直接丢弃
+  if (envid_reply != 0 && envid2env(envid_reply, &env_reply, 0) < 0) {
+    env_reply = NULL;
+  }
+  if (env_reply == curenv) {
+    return -E_INVAL;
+  }
+
+  return ipc_send_recv(env_reply, value_send, segs, nseg, dst_virtual_address);
+}
+
+// 服务进程回复上一个请求（至多共享一个页面），并等待下一个请求
+int sys_ipc_reply_wait(u_int envid_reply, u_int value_send, u_int src_virtual_address,
+                       u_int permission, u_int dst_virtual_address) {
+  struct Ipc_seg seg = {src_virtual_address, src_virtual_address != 0, permission};
+
+  // 检查地址是否合法
+  if (src_virtual_address != 0 && is_illegal_va(src_virtual_address)) {
+    return -E_INVAL;
+  }
+
+  return ipc_reply_wait(envid_reply, value_send, &seg, 1, dst_virtual_address);
+}
+
+// 服务进程回复上一个请求（共享多个页面），并等待下一个请求
+int sys_ipc_reply_waitv(u_int envid_reply, u_int value_send, u_int segs, u_int nseg,
+                        u_int dst_virtual_address) {
+  struct Ipc_seg kern_segs[IPC_SEG_MAX];
+
+  try(ipc_segs_copyin(kern_segs, segs, nseg));
+
+  return ipc_reply_wait(envid_reply, value_send, kern_segs, nseg, dst_virtual_address);
+}
+
 // 读入一个字符，一切输入的起始
 int sys_cgetc(void) {
   int ch;
@@ -462,6 +1173,12 @@ int sys_cgetc(void) {
 #define IDE_BEGIN     (0x180001f0)
 #define IDE_END       (0x180001f0 + 0x8)
 
+// 检查设备地址 [device_addr, device_addr + len) 是否位于允许用户访问的设备（控制台、IDE）中
+static inline int is_illegal_dev_range(u_int device_addr, u_int len) {
+  return !((CONSOLE_BEGIN <= device_addr && device_addr + len <= CONSOLE_END) ||
+           (IDE_BEGIN <= device_addr && device_addr + len <= IDE_END));
+}
+
 /* Overview:
  *  This function is used to write data at 'va' with length 'len' to a device physical address
  *  'pa'. Remember to check the validity of 'va' and 'pa' (see Hint below);
@@ -491,12 +1208,11 @@ int sys_cgetc(void) {
 // device_addr位于kseg1区，不需要经过cache，由硬件直接完成地址转换
 int sys_write_dev(u_int data_addr, u_int device_addr, u_int data_len) {
   // 判断数据所在的虚拟地址是否合法
-  if (is_illegal_va_range(data_addr, data_len)) {
+  if (is_illegal_user_buf(data_addr, data_len)) {
     return -E_INVAL;
   }
   // 检查设备地址合法性
-  if (!((CONSOLE_BEGIN <= device_addr && device_addr + data_len <= CONSOLE_END) ||
-        (IDE_BEGIN     <= device_addr && device_addr + data_len <= IDE_END))) {
+  if (is_illegal_dev_range(device_addr, data_len)) {
     return -E_INVAL;
   }
   // 判断数据长度是否满足要求
@@ -531,12 +1247,11 @@ int sys_write_dev(u_int data_addr, u_int device_addr, u_int data_len) {
 // 从设备读入
 int sys_read_dev(u_int data_addr, u_int device_addr, u_int data_len) {
   // 判断数据所在的虚拟地址是否合法
-  if (is_illegal_va_range(data_addr, data_len)) {
+  if (is_illegal_user_buf(data_addr, data_len)) {
     return -E_INVAL;
   }
   // 检查设备地址合法性
-  if (!((CONSOLE_BEGIN <= device_addr && device_addr + data_len <= CONSOLE_END) ||
-        (IDE_BEGIN     <= device_addr && device_addr + data_len <= IDE_END))) {
+  if (is_illegal_dev_range(device_addr, data_len)) {
     return -E_INVAL;
   }
   // 判断数据长度是否满足要求
@@ -558,6 +1273,198 @@ int sys_read_dev(u_int data_addr, u_int device_addr, u_int data_len) {
   return 0;
 }
 
+/* Overview:
+ *  Write the 'len' bytes at 'va' to the device register at physical address 'pa' of 'width'
+ *  bytes, one 'width'-byte access after another, e.g. a whole sector to the IDE data register.
+ *
+ * Pre-Condition:
+ *  'width' must be 1, 2 or 4, and 'va' and 'len' must be multiples of 'width'.
+ *
+ * Post-Condition:
+ *  Return 0 on success.
+ *  Return -E_INVAL on bad address, width or length.
+ */
+// 将用户缓冲区中的数据依次写入同一个设备寄存器，一次系统调用传输任意长度的数据
+int sys_write_dev_bulk(u_int data_addr, u_int device_addr, u_int width, u_int data_len) {
+  if (width != 1 && width != 2 && width != 4) {
+    return -E_INVAL;
+  }
+  if (data_addr % width != 0 || data_len % width != 0 ||
+      is_illegal_user_buf(data_addr, data_len)) {
+    return -E_INVAL;
+  }
+  if (is_illegal_dev_range(device_addr, width)) {
+    return -E_INVAL;
+  }
+
+  for (u_int i = 0; i < data_len; i += width) {
+    switch (width) {
+      case 1:
+        iowrite8(*(uint8_t *)(data_addr + i), device_addr);
+        break;
+      case 2:
+        iowrite16(*(uint16_t *)(data_addr + i), device_addr);
+        break;
+      case 4:
+        iowrite32(*(uint32_t *)(data_addr + i), device_addr);
+        break;
+    }
+  }
+  return 0;
+}
+
+/* Overview:
+ *  Read 'len' bytes into 'va' from the device register at physical address 'pa' of 'width' bytes,
+ *  one 'width'-byte access after another, e.g. a whole sector from the IDE data register.
+ *
+ * Pre-Condition:
+ *  'width' must be 1, 2 or 4, and 'va' and 'len' must be multiples of 'width'.
+ *
+ * Post-Condition:
+ *  Return 0 on success.
+ *  Return -E_INVAL on bad address, width or length.
+ */
+// 从同一个设备寄存器依次读取数据到用户缓冲区，一次系统调用传输任意长度的数据
+int sys_read_dev_bulk(u_int data_addr, u_int device_addr, u_int width, u_int data_len) {
+  if (width != 1 && width != 2 && width != 4) {
+    return -E_INVAL;
+  }
+  if (data_addr % width != 0 || data_len % width != 0 ||
+      is_illegal_user_buf(data_addr, data_len)) {
+    return -E_INVAL;
+  }
+  if (is_illegal_dev_range(device_addr, width)) {
+    return -E_INVAL;
+  }
+
+  for (u_int i = 0; i < data_len; i += width) {
+    switch (width) {
+      case 1:
+        *(uint8_t *)(data_addr + i) = ioread8(device_addr);
+        break;
+      case 2:
+        *(uint16_t *)(data_addr + i) = ioread16(device_addr);
+        break;
+      case 4:
+        *(uint32_t *)(data_addr + i) = ioread32(device_addr);
+        break;
+    }
+  }
+  return 0;
+}
+
+/* Overview:
+ *  Block the caller until the IDE disk raises its next interrupt (see kern/ide.c). Return at
+ *  once if an interrupt has arrived since the last wait. The caller may also be woken after
+ *  IDE_WAIT_TIMEOUT_TICKS timer interrupts without a disk interrupt, so it must check the IDE
+ *  status after returning.
+ *
+ * Post-Condition:
+ *  Return 0 after the interrupt (or timeout), or -E_NO_SYS if the IDE interrupt is not enabled,
+ *  in which case the caller should poll the status instead.
+ */
+// 阻塞等待磁盘中断，不再轮询磁盘状态
+int sys_ide_wait(void) {
+  int func_info = ide_wait(curenv);
+  if (func_info <= 0) {
+    return func_info;
+  }
+
+  // 阻塞当前进程，由磁盘中断唤醒
+  curenv->env_status = ENV_NOT_RUNNABLE;
+  TAILQ_REMOVE(&env_sched_list, curenv, env_sched_link);
+  ((struct Trapframe *)KSTACKTOP - 1)->regs[2] = 0;
+  schedule(1);
+}
+
+/* Overview:
+ *  Transfer 'nsect' sectors between sector 'sec_no' of disk 'disk_no' and the caller's memory at
+ *  'va' by bus master DMA: into memory if 'to_disk' is 0, otherwise to the disk. The caller is
+ *  blocked until the transfer completes (see 'ide_dma_start' in kern/ide.c).
+ *
+ * Pre-Condition:
+ *  The IDE device is ready (not busy).
+ *
+ * Post-Condition:
+ *  Return 0 on success, -E_UNSPECIFIED if the transfer failed, -E_INVAL if the memory range is
+ *  illegal or not mapped (writable, for transfers into memory), or -E_NO_SYS if DMA is not
+ *  enabled, in which case the caller should use PIO instead.
+ */
+// 通过 DMA 在磁盘与内存之间传输扇区，阻塞至传输完成
+int sys_ide_dma(u_int disk_no, u_int sec_no, u_int va, u_int nsect, u_int to_disk) {
+  if (nsect > MALTA_IDE_MAX_NSECT || is_illegal_va_range(va, nsect * 512)) {
+    return -E_INVAL;
+  }
+
+  int func_info = ide_dma_start(curenv, disk_no, sec_no, va, nsect, to_disk);
+  if (func_info <= 0) {
+    return func_info;
+  }
+
+  // 阻塞当前进程，传输完成的中断唤醒进程并设置返回值
+  curenv->env_status = ENV_NOT_RUNNABLE;
+  TAILQ_REMOVE(&env_sched_list, curenv, env_sched_link);
+  ((struct Trapframe *)KSTACKTOP - 1)->regs[2] = 0;
+  schedule(1);
+}
+
+extern void *syscall_table[MAX_SYSNO];
+
+// 可以在批量系统调用中执行的系统调用：不会阻塞或切换进程
+static const u_char sysring_batchable[MAX_SYSNO] = {
+    [SYS_mem_alloc] = 1, [SYS_mem_map] = 1,   [SYS_mem_unmap] = 1,
+    [SYS_write_dev] = 1, [SYS_read_dev] = 1, [SYS_write_dev_bulk] = 1, [SYS_read_dev_bulk] = 1,
+};
+
+/* Overview:
+ *   Run the system calls submitted to the ring at 'ring_va' (a page holding a struct Sysring),
+ *   from 'sr_head' up to 'sr_tail', in order. The result of each call is posted in its
+ *   'se_ret', and 'sr_head' is advanced past it. A call that cannot be batched gets -E_INVAL and
+ *   the following ones are still run.
+ *
+ * Post-Condition:
+ *   Return the number of calls run.
+ *   Return -E_INVAL if 'ring_va' is not a page-aligned writable page of 'curenv', or more than
+ *   SYSRING_NENT calls are submitted.
+ */
+// 批量执行环形队列中的系统调用
+int sys_sysring_enter(u_int ring_va) {
+  Pte *pte;
+  struct Page *page;
+  int count = 0;
+
+  if ((ring_va & (PAGE_SIZE - 1)) || is_illegal_va(ring_va)) {
+    return -E_INVAL;
+  }
+  // 内核通过 kseg0 访问队列，页面必须可写，避免写入与其他进程共享的写时复制页面
+  page = env_page_lookup(curenv, ring_va, &pte);
+  if (page == NULL || !(*pte & PTE_D)) {
+    return -E_INVAL;
+  }
+  struct Sysring *ring = (struct Sysring *)page2kva(page);
+  if (ring->sr_tail - ring->sr_head > SYSRING_NENT) {
+    return -E_INVAL;
+  }
+
+  // 批量的调用可能解除队列页面的映射，执行期间保持对页面的引用
+  page->pp_ref++;
+  while (ring->sr_head != ring->sr_tail) {
+    struct Sysring_entry *entry = &ring->sr_ent[ring->sr_head % SYSRING_NENT];
+    if (entry->se_sysno < MAX_SYSNO && sysring_batchable[entry->se_sysno]) {
+      int (*func)(u_int, u_int, u_int, u_int, u_int) = syscall_table[entry->se_sysno];
+      entry->se_ret = func(entry->se_args[0], entry->se_args[1], entry->se_args[2],
+                           entry->se_args[3], entry->se_args[4]);
+    } else {
+      entry->se_ret = -E_INVAL;
+    }
+    ring->sr_head++;
+    count++;
+  }
+  page_decref(page);
+
+  return count;
+}
+
 // 系统调用函数列表
 // 通过函数指针获取其中的函数
 void *syscall_table[MAX_SYSNO] = {
@@ -606,6 +1513,33 @@ void *syscall_table[MAX_SYSNO] = {
     // 进程间通信接受信息
     [SYS_ipc_recv]          = sys_ipc_recv,
 
+    // 进程间通信阻塞发送信息，接收方未就绪时在其等待队列中阻塞
+    [SYS_ipc_send]          = sys_ipc_send,
+
+    // 进程间通信调用：发送请求并等待回复
+    [SYS_ipc_call]          = sys_ipc_call,
+
+    // 服务进程回复请求并等待下一个请求
+    [SYS_ipc_reply_wait]    = sys_ipc_reply_wait,
+
+    // 进程间通信阻塞发送多个页面
+    [SYS_ipc_sendv]         = sys_ipc_sendv,
+
+    // 服务进程回复请求（共享多个页面）并等待下一个请求
+    [SYS_ipc_reply_waitv]   = sys_ipc_reply_waitv,
+
+    // 批量执行环形队列中的系统调用
+    [SYS_sysring_enter]     = sys_sysring_enter,
+
+    // 在内核中复制地址空间，创建写时复制的子进程
+    [SYS_fork]              = sys_fork,
+
+    // 在内核中加载可执行文件，创建子进程
+    [SYS_spawn]             = sys_spawn,
+
+    // 注册进程的用户态缺页处理函数
+    [SYS_set_pager]         = sys_set_pager,
+
     // 读入一个字符，一切输入的起始
     [SYS_cgetc]             = sys_cgetc,
 
@@ -614,6 +1548,18 @@ void *syscall_table[MAX_SYSNO] = {
 
     // 从设备读入
     [SYS_read_dev]          = sys_read_dev,
+
+    // 向设备寄存器连续写入一段数据
+    [SYS_write_dev_bulk]    = sys_write_dev_bulk,
+
+    // 从设备寄存器连续读入一段数据
+    [SYS_read_dev_bulk]     = sys_read_dev_bulk,
+
+    // 阻塞等待磁盘中断
+    [SYS_ide_wait]          = sys_ide_wait,
+
+    // 通过 DMA 读写磁盘
+    [SYS_ide_dma]           = sys_ide_dma,
 };
 
 /* Overview:
@@ -648,6 +1594,10 @@ void do_syscall(struct Trapframe *tf) {
   u_int arg3 = tf->regs[7];
   // 再取出保存在栈中的其余两个参数
   u_long sp_address = tf->regs[29];
+  if (is_illegal_user_buf(sp_address + 16, 2 * sizeof(u_int))) {
+    tf->regs[2] = -E_INVAL;
+    return;
+  }
   u_int arg4 = *(u_int *)(sp_address+16);
   u_int arg5 = *(u_int *)(sp_address+20);
 
@@ -1,3 +1,4 @@
+#include <asm/cp0regdef.h>
 #include <bitops.h>
 #include <env.h>
 #include <pmap.h>
@@ -34,6 +35,17 @@ static void passive_alloc(u_int va, Pde *pgdir, u_int asid) {
     panic("kernel address");
   }
 
+#if !defined(LAB) || LAB >= 3
+  // 按需加载的可执行文件中的页面，从文件内容中填充
+  if (curenv != NULL && curenv->env_pgdir == pgdir) {
+    int func_info = icode_fault(curenv, va);
+    if (func_info != -E_INVAL) {
+      panic_on(func_info);
+      return;
+    }
+  }
+#endif
+
   panic_on(page_alloc(&p));
   panic_on(page_insert(pgdir, asid, p, PTE_ADDR(va), (va >= UVPT && va < ULIM) ? 0 : PTE_D));
 }
@@ -61,13 +73,52 @@ void _do_tlb_refill(u_long *pentrylo, u_int virtual_address, u_int asid) {
 
 #if !defined(LAB) || LAB >= 4
 /* Overview:
- *   This is the TLB Mod exception handler in kernel.
- *   Our kernel allows user programs to handle TLB Mod exception in user mode, so we copy its
- *   context 'tf' into UXSTACK and modify the EPC to the registered user exception entry.
+ *   Resolve a write to the copy-on-write page at 'va' of 'curenv' in the kernel: map a private
+ *   writable copy of the page, or just make the page writable if no one else maps it any more.
+ *
+ * Post-Condition:
+ *   Return 0 on success.
+ *   Return -E_INVAL if 'va' is not a copy-on-write page, or -E_NO_MEM if we're out of memory.
  */
-// 处理页写入异常：尝试写入只读页面
-void do_tlb_mod(struct Trapframe *tf) {
-  // 不能直接使用正常情况下的用户栈的：发生页写入异常的也可能是正常栈的页面
+// 在内核中完成写时复制，不必转入用户态的异常处理函数
+static int cow_resolve(u_int va) {
+  Pte *pte;
+  struct Page *page = page_lookup(cur_pgdir, va, &pte);
+  struct Page *copy;
+
+  if (page == NULL || !(*pte & PTE_COW)) {
+    return -E_INVAL;
+  }
+  // 页表也可能与其他进程共享，先复制页表，此后页面的引用计数才是准确的
+  try(pgtable_unshare(cur_pgdir, curenv->env_asid, va));
+  page_lookup(cur_pgdir, va, &pte);
+  u_int perm = ((*pte & 0xfff) & ~PTE_COW) | PTE_D;
+
+  // 其他进程已经不再映射该页面，直接恢复可写即可
+  if (page->pp_ref == 1) {
+    *pte = PTE_ADDR(*pte) | perm;
+    tlb_invalidate(curenv->env_asid, va);
+    return 0;
+  }
+
+  // 复制页面的内容，页面会被完整覆盖，不需要清零
+  try(page_alloc_nozero(&copy));
+  memcpy((void *)page2kva(copy), (void *)page2kva(page), PAGE_SIZE);
+  int func_info = page_insert(cur_pgdir, curenv->env_asid, copy, ROUNDDOWN(va, PAGE_SIZE), perm);
+  if (func_info < 0) {
+    page_free(copy);
+  }
+  return func_info;
+}
+
+/* Overview:
+ *   Pass the exception of 'tf' to the user space handler 'entry': copy the context 'tf' into
+ *   UXSTACK (unless the stack pointer is already in it) and resume at 'entry' with a pointer to
+ *   the saved context as its argument.
+ */
+// 转入用户态的异常处理函数，使用异常处理栈保存原先的现场
+static void user_upcall(struct Trapframe *tf, u_int entry) {
+  // 不能直接使用正常情况下的用户栈的：发生异常的也可能是正常栈的页面
   // 使用**异常处理栈**：栈顶对应的是内存布局中的 UXSTACKTOP
 
   // 保存原先的栈帧
@@ -85,19 +136,60 @@ void do_tlb_mod(struct Trapframe *tf) {
   // 保存原先的栈帧
   *(struct Trapframe *)tf->regs[29] = former_tf;
 
+  // 设定a0寄存器的值为原先的栈帧所在的地址，当返回后可以作为返回值被调用
+  // 具体逻辑见entry.S
+  tf->regs[4] = tf->regs[29];
+  // 留出第一个参数的空间
+  tf->regs[29] -= sizeof(tf->regs[4]);
+  // 取出进程的处理函数，跳转回epc后执行处理函数
+  tf->cp0_epc = entry;
+}
+
+/* Overview:
+ *   This is the TLB Mod exception handler in kernel.
+ *   Writes to copy-on-write pages are resolved here. For other pages (or if we're out of memory),
+ *   our kernel allows user programs to handle TLB Mod exception in user mode, so we copy its
+ *   context 'tf' into UXSTACK and modify the EPC to the registered user exception entry.
+ */
+// 处理页写入异常：尝试写入只读页面
+void do_tlb_mod(struct Trapframe *tf) {
+  // 写时复制的页面直接在内核中处理，返回后重新执行写入
+  if (cow_resolve(tf->cp0_badvaddr) == 0) {
+    return;
+  }
+
   // 如果已经设定了异常处理函数
   if (curenv->env_user_tlb_mod_entry) {
-    // 设定a0寄存器的值为原先的栈帧所在的地址，当返回后可以作为返回值被调用
-    // 具体逻辑见entry.S
-    tf->regs[4] = tf->regs[29];
-    // 留出第一个参数的空间
-    tf->regs[29] -= sizeof(tf->regs[4]);
-    // 取出进程的处理函数，跳转回epc后执行处理函数
-    tf->cp0_epc = curenv->env_user_tlb_mod_entry;
+    user_upcall(tf, curenv->env_user_tlb_mod_entry);
   }
   // 没有设定则崩溃
   else {
     panic("TLB Mod but no user handler registered");
   }
 }
+
+/* Overview:
+ *   This is the TLB Load/Store exception handler in kernel.
+ *   A user mode access to an unmapped page in the range of the pager of 'curenv' (see
+ *   'sys_set_pager') is passed to the pager in user mode. System calls check their user buffers
+ *   against such pages before touching them, so a kernel mode access to one is a kernel bug.
+ *   Other misses are refilled by 'do_tlb_refill' as usual, which reads BadVAddr and EntryHi from
+ *   CP0 by itself.
+ */
+// TLB缺失的异常处理：用户态缺页处理函数负责的页面转入用户态，其余情况执行TLB重填
+void do_tlb_fault(struct Trapframe *tf) {
+  u_int va = tf->cp0_badvaddr;
+
+  if (curenv != NULL && curenv->env_user_pager_entry &&
+      va - curenv->env_pager_va < curenv->env_pager_len &&
+      page_lookup(cur_pgdir, va, NULL) == NULL) {
+    // 内核无法等待用户态填充页面，也不能用零页冒充（见 is_illegal_user_buf）
+    if (!(tf->cp0_status & STATUS_UM)) {
+      panic("kernel access to unfilled pager page %08x", va);
+    }
+    user_upcall(tf, curenv->env_user_pager_entry);
+    return;
+  }
+  do_tlb_refill();
+}
 #endif
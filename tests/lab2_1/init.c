@@ -1,6 +1,7 @@
 void physical_memory_manage_strong_check(void) {
 	struct Page *pp, *pp0, *pp1, *pp2, *pp3, *pp4;
 	struct Page_list fl;
+	struct Page_list buddy_fl[BUDDY_MAX_ORDER + 1];
 	int *temp1;
 
 	// should be able to allocate three pages
@@ -21,6 +22,7 @@ void physical_memory_manage_strong_check(void) {
 	fl = page_free_list;
 	// now this page_free list must be empty!!!!
 	LIST_INIT(&page_free_list);
+	buddy_steal(buddy_fl);
 	// should be no free memory
 	assert(page_alloc(&pp) == -E_NO_MEM);
 
@@ -41,6 +43,7 @@ void physical_memory_manage_strong_check(void) {
 	assert(*temp1 == 0);
 
 	page_free_list = fl;
+	buddy_restore(buddy_fl);
 	page_free(pp0);
 	page_free(pp1);
 	page_free(pp2);
@@ -1,6 +1,7 @@
 void page_strong_check(void) {
 	struct Page *pp, *pp0, *pp1, *pp2, *pp3, *pp4;
 	struct Page_list fl;
+	struct Page_list buddy_fl[BUDDY_MAX_ORDER + 1];
 
 	// should be able to allocate a page for directory
 	assert(page_alloc(&pp) == 0);
@@ -24,6 +25,7 @@ void page_strong_check(void) {
 	fl = page_free_list;
 	// now this page_free list must be empty!!!!
 	LIST_INIT(&page_free_list);
+	buddy_steal(buddy_fl);
 
 	// there is no free memory, so we can't allocate a page table
 	assert(page_insert(boot_pgdir, 0, pp1, 0x0, 0) < 0);
@@ -120,6 +122,7 @@ void page_strong_check(void) {
 
 	// give free list back
 	page_free_list = fl;
+	buddy_restore(buddy_fl);
 
 	// free the pages we took
 	page_free(pp0);
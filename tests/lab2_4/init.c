@@ -0,0 +1,37 @@
+#include <kmalloc.h>
+
+void page_zero_check(void) {
+	struct Page *pp, *pp0;
+	struct Page_zero_stat stat = page_zero_stat;
+
+	// a pre-zeroed page is taken from the pool without zeroing
+	page_zero_refill(1);
+	assert(page_zero_stat.refill == stat.refill + 1);
+	assert(page_alloc(&pp0) == 0);
+	assert(page_zero_stat.hit == stat.hit + 1);
+	for (u_long *p = (u_long *)page2kva(pp0); p < (u_long *)page2kva(pp0 + 1); p++) {
+		assert(*p == 0);
+	}
+
+	// the pool is empty now, the next page is zeroed on allocation
+	assert(page_alloc(&pp) == 0);
+	assert(page_zero_stat.miss == stat.miss + 1);
+	page_free(pp);
+	page_free(pp0);
+
+	page_zero_report();
+	printk("page_zero_check() succeeded!\n");
+}
+
+void mips_init(u_int argc, char **argv, char **penv, u_int ram_low_size) {
+	printk("init.c:\tmips_init() is called\n");
+
+	mips_detect_memory(ram_low_size);
+	mips_vm_init();
+	page_init();
+
+	buddy_check();
+	page_zero_check();
+	kmalloc_check();
+	halt();
+}
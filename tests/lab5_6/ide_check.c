@@ -0,0 +1,65 @@
+#include <lib.h>
+
+static char *motd = "This is /motd, the message of the day.\n\n"
+		    "Welcome to the MOS kernel, now with a file system!\n";
+
+#define BIG_SIZE (64 * 1024)
+
+static char buf[BIG_SIZE];
+
+static void fill(char *p, u_int n, u_int seed) {
+	for (u_int i = 0; i < n; i++) {
+		p[i] = (char)(i * 7 + seed);
+	}
+}
+
+int main() {
+	int r, fdnum, n;
+
+	// this env blocks on the file server, which blocks on the disk:
+	// no env is runnable until the disk interrupt arrives
+	if ((r = open("/motd", O_RDONLY)) < 0) {
+		user_panic("cannot open /motd: %d", r);
+	}
+	fdnum = r;
+	if ((n = read(fdnum, buf, sizeof(buf) - 1)) < 0) {
+		user_panic("cannot read /motd: %d", n);
+	}
+	buf[n] = '\0';
+	if (strcmp(buf, motd) != 0) {
+		user_panic("read returned wrong data");
+	}
+	close(fdnum);
+	debugf("read with disk interrupts is good\n");
+
+	// multi-block writes go out as DMA transfers on sync
+	if ((r = open("/ide_big", O_RDWR | O_CREAT)) < 0) {
+		user_panic("cannot create /ide_big: %d", r);
+	}
+	fdnum = r;
+	fill(buf, BIG_SIZE, 3);
+	if ((n = write(fdnum, buf, BIG_SIZE)) != BIG_SIZE) {
+		user_panic("cannot write /ide_big: %d", n);
+	}
+	close(fdnum);
+	if ((r = sync()) < 0) {
+		user_panic("sync: %d", r);
+	}
+	debugf("write back with dma is good\n");
+
+	if ((r = open("/ide_big", O_RDONLY)) < 0) {
+		user_panic("cannot open /ide_big: %d", r);
+	}
+	fdnum = r;
+	if ((n = readn(fdnum, buf, BIG_SIZE)) != BIG_SIZE) {
+		user_panic("cannot read /ide_big: %d", n);
+	}
+	for (u_int i = 0; i < BIG_SIZE; i++) {
+		if (buf[i] != (char)(i * 7 + 3)) {
+			user_panic("/ide_big differs at byte %d", i);
+		}
+	}
+	close(fdnum);
+	debugf("ide_check() succeeded!\n");
+	return 0;
+}
@@ -0,0 +1,18 @@
+void mips_init(u_int argc, char **argv, char **penv, u_int ram_low_size) {
+	printk("init.c:\tmips_init() is called\n");
+
+	mips_detect_memory(ram_low_size);
+	mips_vm_init();
+	page_init();
+	env_init();
+
+	// the file server waits for disk interrupts and uses DMA
+	ide_irq_init();
+	ide_dma_init();
+
+	ENV_CREATE(test_ide_check);
+	ENV_CREATE(fs_serv);
+
+	schedule(0);
+	panic("init.c:\tend of mips_init() reached!");
+}
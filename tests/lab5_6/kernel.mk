@@ -0,0 +1,2 @@
+init-override := $(test_dir)/init.c
+fs-files      += $(wildcard $(test_dir)/rootfs/*)
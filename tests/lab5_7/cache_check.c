@@ -0,0 +1,143 @@
+#include <fsreq.h>
+#include <lib.h>
+
+// together the two files don't fit in the block cache
+#define FILE_SIZE (3 * 1024 * 1024)
+#define FILE_BLOCKS (FILE_SIZE / BLOCK_SIZE)
+#define CHUNK (64 * 1024)
+
+static char buf[CHUNK];
+
+static char byte_at(u_int offset, u_int seed) {
+	return (char)(offset * 7 + (offset / BLOCK_SIZE) * 13 + seed);
+}
+
+static void cache_stat(struct Fsreq_cache_stat *st) {
+	int r;
+
+	if ((r = fsipc_cache_stat(st)) < 0) {
+		user_panic("fsipc_cache_stat: %d", r);
+	}
+	if (st->req_nblock > st->req_max) {
+		user_panic("%d blocks cached, at most %d", st->req_nblock, st->req_max);
+	}
+}
+
+static void write_file(char *path, u_int seed) {
+	int r, fdnum, n;
+
+	if ((r = open(path, O_RDWR | O_CREAT)) < 0) {
+		user_panic("cannot create %s: %d", path, r);
+	}
+	fdnum = r;
+	for (u_int off = 0; off < FILE_SIZE; off += CHUNK) {
+		for (u_int i = 0; i < CHUNK; i++) {
+			buf[i] = byte_at(off + i, seed);
+		}
+		if ((n = write(fdnum, buf, CHUNK)) != CHUNK) {
+			user_panic("cannot write %s: %d", path, n);
+		}
+	}
+	close(fdnum);
+}
+
+static void read_file(char *path, u_int seed) {
+	int r, fdnum, n;
+
+	if ((r = open(path, O_RDONLY)) < 0) {
+		user_panic("cannot open %s: %d", path, r);
+	}
+	fdnum = r;
+	for (u_int off = 0; off < FILE_SIZE; off += CHUNK) {
+		if ((n = readn(fdnum, buf, CHUNK)) != CHUNK) {
+			user_panic("cannot read %s: %d", path, n);
+		}
+		for (u_int i = 0; i < CHUNK; i++) {
+			if (buf[i] != byte_at(off + i, seed)) {
+				user_panic("%s differs at byte %d", path, off + i);
+			}
+		}
+	}
+	close(fdnum);
+}
+
+int main() {
+	struct Fsreq_cache_stat st0, st1, st2;
+	int r, fdnum, n;
+
+	write_file("/cache_a", 1);
+	write_file("/cache_b", 2);
+	if ((r = sync()) < 0) {
+		user_panic("sync: %d", r);
+	}
+	cache_stat(&st0);
+	if (2 * FILE_BLOCKS <= st0.req_max) {
+		user_panic("the files fit in a cache of %d blocks", st0.req_max);
+	}
+	if (st0.req_ndirty != 0) {
+		user_panic("%d dirty blocks after sync", st0.req_ndirty);
+	}
+	debugf("write is good\n");
+
+	// an open file pins the block holding its File struct
+	if ((r = open("/cache_a", O_RDONLY)) < 0) {
+		user_panic("cannot open /cache_a: %d", r);
+	}
+	fdnum = r;
+	cache_stat(&st1);
+	if (st1.req_npinned <= st0.req_npinned) {
+		user_panic("open pinned no block: %d pinned", st1.req_npinned);
+	}
+
+	// reading both files must evict blocks, but not the pinned ones
+	read_file("/cache_a", 1);
+	read_file("/cache_b", 2);
+	cache_stat(&st2);
+	u_int loaded = (st2.req_misses - st1.req_misses) + (st2.req_readahead - st1.req_readahead);
+	if (loaded < 2 * FILE_BLOCKS - st1.req_max) {
+		user_panic("%d blocks read, only %d loaded", 2 * FILE_BLOCKS, loaded);
+	}
+	if (st2.req_evictions - st1.req_evictions < loaded - (st1.req_max - st1.req_nblock)) {
+		user_panic("%d blocks loaded, only %d evicted", loaded,
+			   st2.req_evictions - st1.req_evictions);
+	}
+	if (st2.req_npinned != st1.req_npinned) {
+		user_panic("%d blocks pinned, %d expected", st2.req_npinned, st1.req_npinned);
+	}
+	debugf("eviction is good\n");
+
+	// the tail of /cache_b was loaded last, so it is still cached; open first, as the lookup may
+	// load directory blocks evicted by the reads above
+	if ((r = open("/cache_b", O_RDONLY)) < 0) {
+		user_panic("cannot open /cache_b: %d", r);
+	}
+	cache_stat(&st1);
+	seek(r, FILE_SIZE - CHUNK);
+	if ((n = readn(r, buf, CHUNK)) != CHUNK) {
+		user_panic("cannot read /cache_b: %d", n);
+	}
+	cache_stat(&st2);
+	close(r);
+	for (u_int i = 0; i < CHUNK; i++) {
+		if (buf[i] != byte_at(FILE_SIZE - CHUNK + i, 2)) {
+			user_panic("/cache_b differs at byte %d", FILE_SIZE - CHUNK + i);
+		}
+	}
+	if (st2.req_misses != st1.req_misses) {
+		user_panic("%d misses on cached blocks", st2.req_misses - st1.req_misses);
+	}
+	if (st2.req_hits - st1.req_hits < CHUNK / BLOCK_SIZE) {
+		user_panic("only %d hits on %d cached blocks", st2.req_hits - st1.req_hits,
+			   CHUNK / BLOCK_SIZE);
+	}
+	debugf("hit is good\n");
+
+	close(fdnum);
+	cache_stat(&st2);
+	if (st2.req_npinned != st0.req_npinned) {
+		user_panic("%d blocks pinned after close, %d expected", st2.req_npinned,
+			   st0.req_npinned);
+	}
+	debugf("cache_check() succeeded!\n");
+	return 0;
+}
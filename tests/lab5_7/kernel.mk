@@ -0,0 +1,3 @@
+init-envs += cache_check /fs_serv
+# the files of the test are larger than the block cache
+fs-nblock := 4096
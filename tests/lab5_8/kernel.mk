@@ -0,0 +1,3 @@
+init-envs += large_check /fs_serv
+# the file of the test is larger than the default disk image
+fs-nblock := 4096
@@ -0,0 +1,137 @@
+#include <lib.h>
+
+// larger than the data area of a file descriptor (MAXFILESIZE)
+#define LARGE_SIZE (6 * 1024 * 1024)
+#define STEP (1024 * 1024)
+#define CHUNK (64 * 1024)
+
+static char *path = "/large";
+static char buf[CHUNK];
+
+// seed 0 stands for a hole, which reads as zeros
+static char byte_at(u_int offset, u_int seed) {
+	return seed ? (char)(offset * 7 + (offset / BLOCK_SIZE) * 13 + seed) : 0;
+}
+
+static int open_at(u_int offset, int mode) {
+	int r;
+
+	if ((r = open(path, mode)) < 0) {
+		user_panic("cannot open %s: %d", path, r);
+	}
+	seek(r, offset);
+	return r;
+}
+
+// pages of the data area mapped by an open file stay shared with the file server and can't be
+// evicted from its cache, so each range is accessed through an open of its own
+static void write_range(u_int offset, u_int len, u_int seed) {
+	int fdnum = open_at(offset, O_RDWR | O_CREAT);
+	int n;
+
+	for (u_int done = 0; done < len;) {
+		u_int piece = MIN(CHUNK, len - done);
+		for (u_int i = 0; i < piece; i++) {
+			buf[i] = byte_at(offset + done + i, seed);
+		}
+		if ((n = write(fdnum, buf, piece)) != piece) {
+			user_panic("cannot write %s at %d: %d", path, offset + done, n);
+		}
+		done += piece;
+	}
+	close(fdnum);
+}
+
+static void check_range(u_int offset, u_int len, u_int seed) {
+	int fdnum = open_at(offset, O_RDONLY);
+	int n;
+
+	for (u_int done = 0; done < len;) {
+		u_int piece = MIN(CHUNK, len - done);
+		if ((n = readn(fdnum, buf, piece)) != piece) {
+			user_panic("cannot read %s at %d: %d", path, offset + done, n);
+		}
+		for (u_int i = 0; i < piece; i++) {
+			if (buf[i] != byte_at(offset + done + i, seed)) {
+				user_panic("%s differs at byte %d", path, offset + done + i);
+			}
+		}
+		done += piece;
+	}
+	close(fdnum);
+}
+
+static void check_size(u_int size) {
+	struct Stat st;
+	int r, fdnum, n;
+
+	if ((r = stat(path, &st)) < 0) {
+		user_panic("cannot stat %s: %d", path, r);
+	}
+	if (st.st_size != size) {
+		user_panic("%s has %d bytes, %d expected", path, st.st_size, size);
+	}
+	fdnum = open_at(size, O_RDONLY);
+	if ((n = read(fdnum, buf, CHUNK)) != 0) {
+		user_panic("read %d bytes beyond the end of %s", n, path);
+	}
+	close(fdnum);
+}
+
+static void truncate(u_int size) {
+	int fdnum = open_at(0, O_RDWR);
+	int r;
+
+	if ((r = ftruncate(fdnum, size)) < 0) {
+		user_panic("cannot truncate %s to %d: %d", path, size, r);
+	}
+	close(fdnum);
+}
+
+int main() {
+	int r;
+
+	for (u_int off = 0; off < LARGE_SIZE; off += STEP) {
+		write_range(off, STEP, 1);
+	}
+	if ((r = sync()) < 0) {
+		user_panic("sync: %d", r);
+	}
+	check_size(LARGE_SIZE);
+	for (u_int off = 0; off < LARGE_SIZE; off += STEP) {
+		check_range(off, STEP, 1);
+	}
+	debugf("write and read of a large file is good\n");
+
+	// across the end of the data area
+	write_range(MAXFILESIZE - CHUNK / 2, CHUNK, 2);
+	check_range(MAXFILESIZE - CHUNK, CHUNK / 2, 1);
+	check_range(MAXFILESIZE - CHUNK / 2, CHUNK, 2);
+	check_range(MAXFILESIZE + CHUNK / 2, CHUNK, 1);
+	debugf("access across MAXFILESIZE is good\n");
+
+	// shrink within the double-indirect part
+	truncate(MAXFILESIZE + 2 * BLOCK_SIZE);
+	check_size(MAXFILESIZE + 2 * BLOCK_SIZE);
+	check_range(MAXFILESIZE - BLOCK_SIZE, 3 * BLOCK_SIZE, 2);
+
+	// shrink below MAXFILESIZE and grow again: the freed blocks come back as holes
+	truncate(STEP);
+	check_size(STEP);
+	truncate(LARGE_SIZE);
+	check_size(LARGE_SIZE);
+	check_range(STEP - CHUNK, CHUNK, 1);
+	check_range(STEP, CHUNK, 0);
+	check_range(MAXFILESIZE - CHUNK / 2, CHUNK, 0);
+	check_range(LARGE_SIZE - CHUNK, CHUNK, 0);
+	debugf("truncate of a large file is good\n");
+
+	if ((r = remove(path)) < 0) {
+		user_panic("cannot remove %s: %d", path, r);
+	}
+	if ((r = open(path, O_RDONLY)) != -E_NOT_FOUND) {
+		user_panic("open of a removed file returned %d", r);
+	}
+	debugf("large_check() succeeded!\n");
+	return 0;
+}
@@ -0,0 +1,4 @@
+init-envs       += legacy_check /fs_serv
+fs-files        += $(wildcard $(test_dir)/rootfs/*)
+# an image without FS_FEATURE_DINDIRECT
+fs-format-flags := -f 0
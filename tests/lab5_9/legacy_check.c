@@ -0,0 +1,81 @@
+#include <lib.h>
+
+static char *motd = "This is /motd, the message of the day.\n\n"
+		    "Welcome to the MOS kernel, now with a file system!\n";
+
+#define SMALL_SIZE (64 * 1024)
+
+static char buf[SMALL_SIZE];
+
+static char byte_at(u_int offset) {
+	return (char)(offset * 7 + (offset / BLOCK_SIZE) * 13 + 5);
+}
+
+int main() {
+	struct Stat st;
+	int r, fdnum, n;
+
+	// the file server mounted an image without FS_FEATURE_DINDIRECT
+	if ((r = open("/motd", O_RDONLY)) < 0) {
+		user_panic("cannot open /motd: %d", r);
+	}
+	fdnum = r;
+	if ((n = read(fdnum, buf, sizeof(buf) - 1)) < 0) {
+		user_panic("cannot read /motd: %d", n);
+	}
+	buf[n] = '\0';
+	if (strcmp(buf, motd) != 0) {
+		user_panic("read returned wrong data");
+	}
+	close(fdnum);
+	debugf("mount is good\n");
+
+	if ((r = open("/legacy", O_RDWR | O_CREAT)) < 0) {
+		user_panic("cannot create /legacy: %d", r);
+	}
+	fdnum = r;
+	for (u_int i = 0; i < SMALL_SIZE; i++) {
+		buf[i] = byte_at(i);
+	}
+	if ((n = write(fdnum, buf, SMALL_SIZE)) != SMALL_SIZE) {
+		user_panic("cannot write /legacy: %d", n);
+	}
+	close(fdnum);
+	if ((r = sync()) < 0) {
+		user_panic("sync: %d", r);
+	}
+	if ((r = open("/legacy", O_RDWR)) < 0) {
+		user_panic("cannot open /legacy: %d", r);
+	}
+	fdnum = r;
+	if ((n = readn(fdnum, buf, SMALL_SIZE)) != SMALL_SIZE) {
+		user_panic("cannot read /legacy: %d", n);
+	}
+	for (u_int i = 0; i < SMALL_SIZE; i++) {
+		if (buf[i] != byte_at(i)) {
+			user_panic("/legacy differs at byte %d", i);
+		}
+	}
+	debugf("write and read is good\n");
+
+	// without the double-indirect block a file holds at most MAXFILESIZE bytes
+	if ((r = ftruncate(fdnum, MAXFILESIZE)) < 0) {
+		user_panic("cannot truncate /legacy to MAXFILESIZE: %d", r);
+	}
+	if ((r = ftruncate(fdnum, MAXFILESIZE + BLOCK_SIZE)) != -E_NO_DISK) {
+		user_panic("truncate beyond MAXFILESIZE returned %d", r);
+	}
+	seek(fdnum, MAXFILESIZE);
+	if ((n = write(fdnum, buf, BLOCK_SIZE)) >= 0) {
+		user_panic("write beyond MAXFILESIZE returned %d", n);
+	}
+	close(fdnum);
+	if ((r = stat("/legacy", &st)) < 0) {
+		user_panic("cannot stat /legacy: %d", r);
+	}
+	if (st.st_size != MAXFILESIZE) {
+		user_panic("/legacy has %d bytes, %d expected", st.st_size, MAXFILESIZE);
+	}
+	debugf("legacy_check() succeeded!\n");
+	return 0;
+}
@@ -22,9 +22,14 @@
 typedef struct Super Super;
 typedef struct File File;
 
-// 磁盘中磁盘块的数量
+// 磁盘中磁盘块的默认数量，可以通过 -n 选项指定
 #define NBLOCK 1024
 
+// 磁盘中磁盘块的数量
+uint32_t nblock = NBLOCK;
+// 文件系统的特性，可以通过 -f 选项指定，-f 0 生成不支持二级间接指针的旧格式镜像
+uint32_t features = FS_FEATURE_DINDIRECT;
+
 // 存储位图所需要的磁盘块数量
 uint32_t nbitblock;
 // 下一个可用磁盘块的id
@@ -51,7 +56,7 @@ struct Block {
   uint8_t data[BLOCK_SIZE];
   // 磁盘块的类型
   uint32_t type;
-} disk[NBLOCK];
+} *disk;
 
 // reverse: mutually transform between little endian and big endian.
 // 进行大小尾端转换
@@ -80,6 +85,7 @@ void reverse_block(struct Block *b) {
     s = (struct Super *)b->data;
     reverse(&s->s_magic);
     reverse(&s->s_nblocks);
+    reverse(&s->s_features);
 
     ff = &s->s_root;
     reverse(&ff->f_size);
@@ -88,6 +94,7 @@ void reverse_block(struct Block *b) {
       reverse(&ff->f_direct[i]);
     }
     reverse(&ff->f_indirect);
+    reverse(&ff->f_dindirect);
     break;
   case BLOCK_FILE:
     f = (struct File *)b->data;
@@ -102,6 +109,7 @@ void reverse_block(struct Block *b) {
           reverse(&ff->f_direct[j]);
         }
         reverse(&ff->f_indirect);
+        reverse(&ff->f_dindirect);
       }
     }
     break;
@@ -123,7 +131,7 @@ void init_disk() {
   disk[0].type = BLOCK_BOOT;
 
   // 存储位图所需要的磁盘块数量
-  nbitblock = (NBLOCK + BLOCK_SIZE_BIT - 1) / BLOCK_SIZE_BIT;
+  nbitblock = (nblock + BLOCK_SIZE_BIT - 1) / BLOCK_SIZE_BIT;
   // 从第3个磁盘块开始设置磁盘的位图
   nextbno = 2 + nbitblock;
   // 设置位图块
@@ -135,8 +143,8 @@ void init_disk() {
     memset(disk[2 + i].data, 0xff, BLOCK_SIZE);
   }
   // 如果位图无法完全占满磁盘块，将多余的位设置为0
-  if (NBLOCK != nbitblock * BLOCK_SIZE_BIT) {
-    diff_offest = NBLOCK % BLOCK_SIZE_BIT / 8;
+  if (nblock != nbitblock * BLOCK_SIZE_BIT) {
+    diff_offest = nblock % BLOCK_SIZE_BIT / 8;
     memset(disk[2 + (nbitblock - 1)].data + diff_offest, 0x00, BLOCK_SIZE - diff_offest);
   }
 
@@ -144,13 +152,20 @@ void init_disk() {
   disk[1].type = BLOCK_SUPER;
   // 初始化超级块
   super.s_magic = FS_MAGIC;
-  super.s_nblocks = NBLOCK;
+  super.s_nblocks = nblock;
+  // 文件是否可以使用二级间接指针
+  super.s_features = features;
   super.s_root.f_type = FTYPE_DIR;
   strcpy(super.s_root.f_name, "/");
 }
 
 // 获取下一个可用磁盘块的id
 int next_block(int type) {
+  // 检查磁盘是否已满
+  if (nextbno >= nblock) {
+    fprintf(stderr, "disk image is full\n");
+    exit(1);
+  }
   disk[nextbno].type = type;
   return nextbno++;
 }
@@ -172,7 +187,7 @@ void finish_fs(char *name) {
 
   // Dump data in `disk` to target image file.
   fd = open(name, O_RDWR | O_CREAT, 0666);
-  for (i = 0; i < 1024; ++i) {
+  for (i = 0; i < nblock; ++i) {
 #ifdef CONFIG_REVERSE_ENDIAN
     reverse_block(disk + i);
 #endif
@@ -187,20 +202,38 @@ void finish_fs(char *name) {
 // 将磁盘块添加到目录下
 void save_block_link(struct File *dictionary_file, int block_num_used, int block_no) {
   // 检查文件是否过大
-  assert(block_num_used < NINDIRECT);
+  assert(block_num_used < MAXFILESIZE_DINDIRECT / BLOCK_SIZE);
+  if (block_num_used >= NINDIRECT && !(super.s_features & FS_FEATURE_DINDIRECT)) {
+    fprintf(stderr, "file is too large without the double-indirect block\n");
+    exit(1);
+  }
 
   // 目录下属的文件较少，使用直接指针
   if (block_num_used < NDIRECT) {
     dictionary_file->f_direct[block_num_used] = block_no;
   }
   // 使用间接指针
-  else {
+  else if (block_num_used < NINDIRECT) {
     // 为间接指针分配一个空闲磁盘块，用于存储其他磁盘块
     if (dictionary_file->f_indirect == 0) {
       dictionary_file->f_indirect = next_block(BLOCK_INDEX);
     }
     ((uint32_t *)(disk[dictionary_file->f_indirect].data))[block_num_used] = block_no;
   }
+  // 使用二级间接指针
+  else {
+    // 为二级间接指针分配一个磁盘块，用于存储间接指针磁盘块
+    if (dictionary_file->f_dindirect == 0) {
+      dictionary_file->f_dindirect = next_block(BLOCK_INDEX);
+    }
+    uint32_t *dindirect = (uint32_t *)(disk[dictionary_file->f_dindirect].data);
+    uint32_t index = block_num_used - NINDIRECT;
+    // 为间接指针分配一个磁盘块
+    if (dindirect[index / NINDIRECT] == 0) {
+      dindirect[index / NINDIRECT] = next_block(BLOCK_INDEX);
+    }
+    ((uint32_t *)(disk[dindirect[index / NINDIRECT]].data))[index % NINDIRECT] = block_no;
+  }
 }
 
 // 获取下一个空闲的磁盘控制块，并添加到对应目录下
@@ -344,15 +377,36 @@ void write_directory(struct File *dictionary_file, char *path) {
 
 int main(int argc, char **argv) {
   static_assert(sizeof(struct File) == FILE_STRUCT_SIZE);
-  init_disk();
 
-  if (argc < 3) {
-    fprintf(stderr, "Usage: fsformat <img-file> [files or directories]...\n");
+  // -n 指定磁盘块的数量，不超过文件系统服务进程能够处理的最大磁盘（1GB）
+  // -f 指定文件系统的特性
+  int opt;
+  while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+    switch (opt) {
+    case 'n':
+      nblock = strtoul(optarg, NULL, 0);
+      break;
+    case 'f':
+      features = strtoul(optarg, NULL, 0);
+      break;
+    default:
+      nblock = 0;
+      break;
+    }
+  }
+  if (argc - optind < 2 || nblock < 16 || nblock > MAXFILESIZE_DINDIRECT / BLOCK_SIZE ||
+      (features & ~FS_FEATURES_SUPPORTED)) {
+    fprintf(stderr,
+            "Usage: fsformat [-n nblock] [-f features] <img-file> [files or directories]...\n");
     exit(1);
   }
 
+  disk = calloc(nblock, sizeof(struct Block));
+  assert(disk != NULL);
+  init_disk();
+
   // 创建磁盘镜像文件
-  for (int i = 2; i < argc; i++) {
+  for (int i = optind + 1; i < argc; i++) {
     char *name = argv[i];
     struct stat stat_buf;
     int r = stat(name, &stat_buf);
@@ -376,7 +430,7 @@ int main(int argc, char **argv) {
   // 根据磁盘块的使用情况设置位图
   flush_bitmap();
   // 根据disk生成磁盘镜像文件
-  finish_fs(argv[1]);
+  finish_fs(argv[optind]);
 
   return 0;
 }
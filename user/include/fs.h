@@ -24,8 +24,12 @@
 #define NDIRECT 10
 // 文件占据的最大磁盘块数（不直接指针个数）：一个磁盘块能容纳的最多指针数
 #define NINDIRECT (BLOCK_SIZE / 4)
-// 文件的最大大小
+// 文件的最大大小，也是客户进程中一个文件的映射窗口的大小
 #define MAXFILESIZE (NINDIRECT * BLOCK_SIZE)
+// 二级间接指针可以访问的磁盘块数，从第 NINDIRECT 个文件块开始
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+// 支持二级间接指针（FS_FEATURE_DINDIRECT）时文件的最大大小，与可以处理的最大磁盘相同（1GB）
+#define MAXFILESIZE_DINDIRECT 0x40000000
 
 #define FILE_STRUCT_SIZE 256
 
@@ -43,10 +47,13 @@ struct File {
   // 用于存储 更多的磁盘块指针 的磁盘块的磁盘控制块id
   // 在文件大小超过40KB时使用，共1024个指针，但不使用前10个指针
   uint32_t f_indirect;
+  // 二级间接指针：其磁盘块存储1024个间接指针磁盘块的id，在文件大小超过4MB时使用
+  // 仅在超级块设置了 FS_FEATURE_DINDIRECT 时有效，旧的磁盘镜像中此处是 f_dir 的旧值
+  uint32_t f_dindirect;
   // 指向文件所属的文件目录
   struct File *f_dir;
   // 让文件控制块和PAGE_SIZE对齐的填充部分
-  char f_pad[FILE_STRUCT_SIZE - MAXNAMELEN - (3 + NDIRECT) * 4 - sizeof(void *)];
+  char f_pad[FILE_STRUCT_SIZE - MAXNAMELEN - (4 + NDIRECT) * 4 - sizeof(void *)];
 } __attribute__((aligned(4), packed));
 
 // 一个磁盘块拥有的文件控制块数目
@@ -61,6 +68,12 @@ struct File {
 
 #define FS_MAGIC 0x68286097 // Everyone's favorite OS class
 
+// 文件系统的特性，记录在超级块中；旧的磁盘镜像中为0
+// 文件控制块的 f_dindirect 有效
+#define FS_FEATURE_DINDIRECT 0x1
+// 本文件系统支持的全部特性
+#define FS_FEATURES_SUPPORTED (FS_FEATURE_DINDIRECT)
+
 // 超级块，用于描述文件系统的基本信息，如Magic Number、磁盘大小以及根目录的位置。
 struct Super {
   // 魔数，用于标识该文件系统。
@@ -69,6 +82,8 @@ struct Super {
   uint32_t s_nblocks;
   // 根目录节点，根目录的f_type为FTYPE_DIR，f_name为 “/”
   struct File s_root;
+  // 文件系统的特性 FS_FEATURE_*
+  uint32_t s_features;
 };
 
 #endif // _FS_H_
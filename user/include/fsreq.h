@@ -20,6 +20,8 @@ enum {
 	FSREQ_REMOVE,
   // 同步文件，向磁盘写回被修改过的文件
 	FSREQ_SYNC,
+  // 获取磁盘块缓存的统计信息
+	FSREQ_CACHE_STAT,
 	MAX_FSREQNO,
 };
 
@@ -30,10 +32,11 @@ struct Fsreq_open {
 	u_int req_omode;
 };
 
-// map操作的文件ipc请求
+// map操作的文件ipc请求：映射从req_offset开始的至多req_npages个磁盘块
 struct Fsreq_map {
 	int req_fileid;
 	u_int req_offset;
+	u_int req_npages;
 };
 
 // set_size操作的文件ipc请求
@@ -47,10 +50,11 @@ struct Fsreq_close {
 	int req_fileid;
 };
 
-// dirty操作的文件ipc请求
+// dirty操作的文件ipc请求：将从req_offset开始的req_npages个磁盘块标记为脏
 struct Fsreq_dirty {
 	int req_fileid;
 	u_int req_offset;
+	u_int req_npages;
 };
 
 // remove操作的文件ipc请求
@@ -58,4 +62,20 @@ struct Fsreq_remove {
 	char req_path[MAXPATHLEN];
 };
 
+// cache_stat操作的文件ipc请求：文件服务进程将磁盘块缓存的统计信息写回请求页面
+struct Fsreq_cache_stat {
+	u_int req_hits;
+	u_int req_misses;
+	u_int req_evictions;
+	// 预读载入的磁盘块数
+	u_int req_readahead;
+	// 当前缓存的磁盘块数与最多缓存的磁盘块数
+	u_int req_nblock;
+	u_int req_max;
+	// 当前的脏块数
+	u_int req_ndirty;
+	// 当前固定（常驻内存）的磁盘块数
+	u_int req_npinned;
+};
+
 #endif
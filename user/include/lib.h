@@ -56,6 +56,7 @@ u_int syscall_getenvid(void);
 void syscall_yield(void);
 int syscall_env_destroy(u_int envid);
 int syscall_set_tlb_mod_entry(u_int envid, void (*func)(struct Trapframe *));
+int syscall_set_pager(u_int envid, void (*func)(struct Trapframe *), u_int va, u_int len);
 int syscall_mem_alloc(u_int envid, void *va, u_int perm);
 int syscall_mem_map(u_int srcid, void *srcva, u_int dstid, void *dstva, u_int perm);
 int syscall_mem_unmap(u_int envid, void *va);
@@ -66,18 +67,41 @@ __attribute__((always_inline)) inline static int syscall_exofork(void) {
   return msyscall(SYS_exofork, 0, 0, 0, 0, 0);
 }
 
+int syscall_fork(void);
+int syscall_spawn(const void *binary, u_int size, char **argv);
 int syscall_set_env_status(u_int envid, u_int status);
 int syscall_set_trapframe(u_int envid, struct Trapframe *tf);
 void syscall_panic(const char *msg) __attribute__((noreturn));
 int syscall_ipc_try_send(u_int envid, u_int value, const void *srcva, u_int perm);
+int syscall_ipc_send(u_int envid, u_int value, const void *srcva, u_int perm);
 int syscall_ipc_recv(void *dstva);
+int syscall_ipc_call(u_int envid, u_int value, const void *srcva, u_int perm, void *dstva);
+int syscall_ipc_reply_wait(u_int envid, u_int value, const void *srcva, u_int perm, void *dstva);
+int syscall_ipc_sendv(u_int envid, u_int value, const struct Ipc_seg *segs, u_int nseg);
+int syscall_ipc_reply_waitv(u_int envid, u_int value, const struct Ipc_seg *segs, u_int nseg,
+                            void *dstva);
 int syscall_cgetc(void);
 int syscall_write_dev(void *va, u_int dev, u_int len);
 int syscall_read_dev(void *va, u_int dev, u_int len);
+int syscall_write_dev_bulk(void *va, u_int dev, u_int width, u_int len);
+int syscall_read_dev_bulk(void *va, u_int dev, u_int width, u_int len);
+int syscall_ide_wait(void);
+int syscall_ide_dma(u_int disk_no, u_int sec_no, void *va, u_int nsect, int to_disk);
+
+// sysring.c
+void sysring_submit(u_int sysno, u_int arg1, u_int arg2, u_int arg3, u_int arg4, u_int arg5);
+int sysring_flush(void);
 
 // ipc.c
 void ipc_send(u_int whom, u_int val, const void *srcva, u_int perm);
 u_int ipc_recv(u_int *whom, void *dstva, u_int *perm);
+u_int ipc_call(u_int whom, u_int val, const void *srcva, u_int perm, void *dstva,
+               u_int *perm_store);
+u_int ipc_reply_wait(u_int whom, u_int val, const void *srcva, u_int perm, u_int *from,
+                     void *dstva, u_int *perm_store);
+void ipc_sendv(u_int whom, u_int val, const struct Ipc_seg *segs, u_int nseg);
+u_int ipc_reply_waitv(u_int whom, u_int val, const struct Ipc_seg *segs, u_int nseg, u_int *from,
+                      void *dstva, u_int *perm_store);
 
 // wait.c
 void wait(u_int envid);
@@ -99,12 +123,14 @@ int printf(const char *fmt, ...);
 
 // fsipc.c
 int fsipc_open(const char *, u_int, struct Fd *);
-int fsipc_map(u_int, u_int, void *);
+int fsipc_map(u_int, u_int, u_int, void *);
 int fsipc_set_size(u_int, u_int);
 int fsipc_close(u_int);
-int fsipc_dirty(u_int, u_int);
+int fsipc_dirty(u_int, u_int, u_int);
 int fsipc_remove(const char *);
 int fsipc_sync(void);
+struct Fsreq_cache_stat;
+int fsipc_cache_stat(struct Fsreq_cache_stat *);
 int fsipc_incref(u_int);
 
 // fd.c
@@ -124,6 +150,8 @@ int read_map(int fd, u_int offset, void **blk);
 int remove(const char *path);
 int ftruncate(int fd, u_int size);
 int sync(void);
+int mmap(int fd, u_int offset, u_int len, int prot, void **va);
+int file_populate(int fd, u_int offset, u_int len);
 
 #define user_assert(x) \
   do { \
@@ -149,4 +177,8 @@ int sync(void);
 #define O_EXCL 0x0400  /* error if already exists */
 #define O_MKDIR 0x0800 /* create directory, not regular file */
 
+// mmap 的访问权限
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+
 #endif
@@ -3,12 +3,19 @@
 
 #define debug 0
 
+// 文件中前 MAXFILESIZE 字节映射在文件描述符的数据区（PDMAP）中，之后的部分通过这个地址临时映射单个磁盘块访问
+#define FILE_BOUNCE_VA (FDTABLE - PAGE_SIZE)
+
 // 为用户程序提供一系列库函数来完成文件的相关操作
 
 static int file_close(struct Fd *fd);
 static int file_read(struct Fd *fd, void *buf, u_int n, u_int offset);
 static int file_write(struct Fd *fd, const void *buf, u_int n, u_int offset);
 static int file_stat(struct Fd *fd, struct Stat *stat);
+static int file_window_remap(struct Fd *fd, u_int offset, u_int end);
+
+// 数据区被 mmap 为只读（没有 PROT_WRITE）的文件描述符，其中的页面映射时不带 PTE_D
+static u_char file_window_ro[MAXFD];
 
 // Dot represents choosing the member within the struct declaration
 // to initialize, with no need to consider the order of members.
@@ -21,6 +28,46 @@ struct Dev devfile = {
   .dev_stat = file_stat,
 };
 
+// Overview:
+//  The pager of the file data area. A page of an open file is mapped from the file server only
+//  when it is first accessed (see 'sys_set_pager'), so that opening a file costs the same
+//  regardless of its size, and untouched pages never cross IPC.
+// 文件数据区的缺页处理函数：向文件服务进程请求缺失的那一个磁盘块
+static void __attribute__((noreturn)) file_pager(struct Trapframe *tf) {
+  u_int va = tf->cp0_badvaddr;
+  int func_info;
+
+  // 根据地址找到对应的文件描述符
+  struct Fd *fd = (struct Fd *)INDEX2FD((va - FILEBASE) / PDMAP);
+  if (!(vpd[PDX(fd)] & PTE_V) || !(vpt[VPN(fd)] & PTE_V) || fd->fd_dev_id != devfile.dev_id) {
+    user_panic("file_pager: %08x is not in an open file", va);
+  }
+  struct Filefd *file_fd = (struct Filefd *)fd;
+  u_int offset = ROUNDDOWN(va - (u_int)fd2data(fd), PTMAP);
+  if (offset >= file_fd->f_file.f_size) {
+    user_panic("file_pager: %08x is beyond the end of the file", va);
+  }
+
+  if ((func_info = fsipc_map(file_fd->f_fileid, offset, 1, fd2data(fd) + offset)) < 0) {
+    user_panic("file_pager: fsipc_map %08x: %d", va, func_info);
+  }
+  if ((func_info = file_window_remap(fd, offset, offset + PTMAP)) < 0) {
+    user_panic("file_pager: file_window_remap %08x: %d", va, func_info);
+  }
+  // 恢复到发生缺页时的现场，重新执行访问
+  func_info = syscall_set_trapframe(0, tf);
+  user_panic("syscall_set_trapframe returned %d", func_info);
+}
+
+// 为当前进程注册文件数据区的缺页处理函数
+// 通过 spawn 创建的进程也会继承打开的文件，因此在访问文件数据区之前都需要检查
+static int file_pager_setup(void) {
+  if (env->env_user_pager_entry != (u_int)file_pager) {
+    try(syscall_set_pager(0, file_pager, FILEBASE, MAXFD * PDMAP));
+  }
+  return 0;
+}
+
 // Overview:
 //  Open a file (or directory).
 //
@@ -38,23 +85,41 @@ int open(const char *file_path, int mode) {
   // 文件服务进程会通过fd设置相关信息
   try(fsipc_open(file_path, mode, fd));
 
-  // 获取文件内容应该映射到的地址
-  char *file_va = fd2data(fd);
-  // 通过指针类型，改变文件描述符地址处信息的解释方式
-  struct Filefd *filefd = (struct Filefd *)fd;
-  // 这些信息之前由文件服务进程设置
-  u_int file_size = filefd->f_file.f_size;
-  u_int file_id = filefd->f_fileid;
-
-  // 将文件的内容映加载到内存中，方式为建立相关的映射关系
-  for (int i = 0; i < file_size; i += PTMAP) {
-    try(fsipc_map(file_id, i, file_va + i));
-  }
+  // 文件的内容不在此时映射，而是在第一次访问时由 file_pager 按页映射
+  try(file_pager_setup());
 
   // 返回文件描述符对应的id
   return fd2num(fd);
 }
 
+// 文件数据区中的页面是否已经映射
+static int file_page_mapped(void *va) {
+  return (vpd[PDX(va)] & PTE_V) && (vpt[VPN(va)] & PTE_V);
+}
+
+// 文件数据区是否可写：以只读方式打开，或数据区被 mmap 为只读时不可写
+static int file_window_writable(struct Fd *fd) {
+  return (fd->fd_omode & O_ACCMODE) != O_RDONLY && !file_window_ro[fd2num(fd)];
+}
+
+// Overview:
+//  Make the mapped pages of the data area of 'fd' in [offset, end) writable or read-only
+//  according to 'file_window_writable'. The file server always replies with PTE_D.
+// 按数据区的保护属性重新设置已映射页面的权限
+static int file_window_remap(struct Fd *fd, u_int offset, u_int end) {
+  void *file_va = fd2data(fd);
+  u_int perm = file_window_writable(fd) ? PTE_D | PTE_LIBRARY : PTE_LIBRARY;
+
+  for (u_int i = offset; i < end; i += PTMAP) {
+    if (!file_page_mapped(file_va + i) ||
+        (vpt[VPN(file_va + i)] & (PTE_D | PTE_LIBRARY)) == perm) {
+      continue;
+    }
+    try(syscall_mem_map(0, file_va + i, 0, file_va + i, perm));
+  }
+  return 0;
+}
+
 // Overview:
 //  Close a file descriptor
 // 关闭文件描述符对应的文件
@@ -67,13 +132,24 @@ int file_close(struct Fd *fd) {
   // 获取文件大小
   u_int file_size = file_fd->f_file.f_size;
 
-  int func_info, i;
+  int func_info;
+  u_int i, start;
 
-  // 将文件的每一页标记为脏
-  for (i = 0; i < file_size; i += PTMAP) {
-    if ((func_info = fsipc_dirty(file_id, i)) < 0) {
-      debugf("cannot mark pages as dirty\n");
-      return func_info;
+  // 只有数据区中的部分会被映射
+  file_size = MIN(file_size, MAXFILESIZE);
+  file_window_ro[fd2num(fd)] = 0;
+
+  // 只有映射过的页面才可能被修改，将以写方式打开的文件中连续映射的页面一次标记为脏
+  if ((fd->fd_omode & O_ACCMODE) != O_RDONLY) {
+    for (i = 0; i < file_size;) {
+      for (; i < file_size && !file_page_mapped(file_va + i); i += PTMAP) {
+      }
+      for (start = i; i < file_size && file_page_mapped(file_va + i); i += PTMAP) {
+      }
+      if (i > start && (func_info = fsipc_dirty(file_id, start, (i - start) / PTMAP)) < 0) {
+        debugf("cannot mark pages as dirty\n");
+        return func_info;
+      }
     }
   }
 
@@ -88,6 +164,9 @@ int file_close(struct Fd *fd) {
     return 0;
   }
   for (i = 0; i < file_size; i += PTMAP) {
+    if (!file_page_mapped(file_va + i)) {
+      continue;
+    }
     if ((func_info = syscall_mem_unmap(0, (void *)(file_va + i))) < 0) {
       debugf("cannont unmap the file\n");
       return func_info;
@@ -97,10 +176,43 @@ int file_close(struct Fd *fd) {
   return 0;
 }
 
+// Overview:
+//  Copy 'n' bytes between 'buffer' and the open file at 'offset', which is beyond the data area
+//  of the file descriptor (MAXFILESIZE), one block at a time: each block is mapped at
+//  FILE_BOUNCE_VA, copied, marked dirty if written, and unmapped.
+//
+// Returns:
+//  'n' on success, < 0 on failure.
+// 读写文件中超出数据区的部分，每次临时映射一个磁盘块
+static int file_bounce(struct Filefd *file_fd, void *buffer, u_int n, u_int offset, int write) {
+  void *bounce = (void *)FILE_BOUNCE_VA;
+  int func_info;
+
+  for (u_int done = 0; done < n;) {
+    u_int block_offset = ROUNDDOWN(offset + done, BLOCK_SIZE);
+    u_int in_block = offset + done - block_offset;
+    u_int len = MIN(BLOCK_SIZE - in_block, n - done);
+
+    try(fsipc_map(file_fd->f_fileid, block_offset, 1, bounce));
+    func_info = 0;
+    if (write) {
+      memcpy(bounce + in_block, buffer + done, len);
+      func_info = fsipc_dirty(file_fd->f_fileid, block_offset, 1);
+    } else {
+      memcpy(buffer + done, bounce + in_block, len);
+    }
+    panic_on(syscall_mem_unmap(0, bounce));
+    try(func_info);
+    done += len;
+  }
+  return n;
+}
+
 // Overview:
 //  Read 'n' bytes from 'fd' at the current seek position into 'buf'. Since files
 //  are memory-mapped, this amounts to a memcpy() surrounded by a little red
 //  tape to handle the file size and seek pointer.
+//  The part of a large file beyond MAXFILESIZE is read through 'file_bounce'.
 // 从文件的offest处读取n个字节到buffer，返回实际读取的字节
 static int file_read(struct Fd *fd, void *buffer, u_int n, u_int offset) {
   struct Filefd *file_fd = (struct Filefd *)fd;
@@ -113,8 +225,14 @@ static int file_read(struct Fd *fd, void *buffer, u_int n, u_int offset) {
   if (offset + n > file_size) {
     n = file_size - offset;
   }
-  // 拷贝对应的地址
-  memcpy(buffer, (char *)fd2data(fd) + offset, n);
+  // 拷贝对应的地址，未映射的页面由 file_pager 映射
+  u_int mapped = offset < MAXFILESIZE ? MIN(n, MAXFILESIZE - offset) : 0;
+  try(file_pager_setup());
+  memcpy(buffer, (char *)fd2data(fd) + offset, mapped);
+  // 超出数据区的部分
+  if (n > mapped) {
+    try(file_bounce(file_fd, buffer + mapped, n - mapped, offset + mapped, 0));
+  }
   return n;
 }
 
@@ -136,17 +254,17 @@ int read_map(int fd_no, u_int offset, void **va_pointer) {
     return -E_INVAL;
   }
 
-  if (offset >= MAXFILESIZE) {
+  if (offset >= ((struct Filefd *)fd)->f_file.f_size) {
     return -E_NO_DISK;
   }
+  // 超出数据区的部分无法映射
+  if (offset >= MAXFILESIZE) {
+    return -E_INVAL;
+  }
 
-  // 获取地址
+  // 获取地址，页面尚未映射时立即映射
   va = fd2data(fd) + offset;
-
-  // 检查文件是否被载入磁盘：检查页表
-  if (!(vpd[PDX(va)] & PTE_V) || !(vpt[VPN(va)] & PTE_V)) {
-    return -E_NO_DISK;
-  }
+  try(file_populate(fd_no, offset, 1));
 
   // 地址写入指针
   *va_pointer = va;
@@ -155,14 +273,15 @@ int read_map(int fd_no, u_int offset, void **va_pointer) {
 
 // Overview:
 //  Write 'n' bytes from 'buf' to 'fd' at the current seek position.
+//  The part of a large file beyond MAXFILESIZE is written through 'file_bounce'.
 // 将buffer中n个字节写入到文件的offest处
 static int file_write(struct Fd *fd, const void *buffer, u_int n, u_int offset) {
   struct Filefd *file_fd = (struct Filefd *)fd;
   u_int final_place = offset + n;
   int func_info;
 
-  // 最后终点比最大文件尺寸，报错
-  if (final_place > MAXFILESIZE) {
+  // 最后终点比最大文件尺寸，报错；文件系统不支持大文件时由文件服务进程报错
+  if (final_place < offset || final_place > MAXFILESIZE_DINDIRECT) {
     return -E_NO_DISK;
   }
 
@@ -173,8 +292,17 @@ static int file_write(struct Fd *fd, const void *buffer, u_int n, u_int offset)
     }
   }
 
-  // 拷贝数据
-  memcpy((char *)fd2data(fd) + offset, buffer, n);
+  // 拷贝数据，未映射的页面由 file_pager 映射；只读的数据区中的部分也逐块写入
+  u_int mapped = offset < MAXFILESIZE ? MIN(n, MAXFILESIZE - offset) : 0;
+  if (!file_window_writable(fd)) {
+    mapped = 0;
+  }
+  try(file_pager_setup());
+  memcpy((char *)fd2data(fd) + offset, buffer, mapped);
+  // 超出数据区的部分
+  if (n > mapped) {
+    try(file_bounce(file_fd, (void *)buffer + mapped, n - mapped, offset + mapped, 1));
+  }
   return n;
 }
 
@@ -195,7 +323,7 @@ int ftruncate(int fd_no, u_int new_size) {
   struct Fd *fd;
   int func_info, i;
 
-  if (new_size > MAXFILESIZE) {
+  if (new_size > MAXFILESIZE_DINDIRECT) {
     return -E_NO_DISK;
   }
 
@@ -211,29 +339,21 @@ int ftruncate(int fd_no, u_int new_size) {
   struct Filefd *file_fd = (struct Filefd *)fd;
   u_int old_size = file_fd->f_file.f_size;
   u_int file_id = file_fd->f_fileid;
-  // 设置大小
-  file_fd->f_file.f_size = new_size;
+  // 设置大小，文件服务进程拒绝时保持原大小
   if ((func_info = fsipc_set_size(file_id, new_size)) < 0) {
     return func_info;
   }
+  file_fd->f_file.f_size = new_size;
 
   // 获得文件在内存中的地址
   void *file_va = fd2data(fd);
 
-  // 如果大小变大，则载入新页面
-  for (i = ROUND(old_size, PTMAP); i < ROUND(new_size, PTMAP); i += PTMAP) {
-    // 将磁盘块加载进内存
-    if ((func_info = fsipc_map(file_id, i, file_va + i)) < 0) {
-      int func_info_2 = fsipc_set_size(file_id, old_size);
-      if (func_info_2 < 0) {
-        return func_info_2;
-      }
-      return func_info;
+  // 如果大小变大，新页面在第一次访问时由 file_pager 映射
+  // 如果大小变小，则取消数据区中的映射
+  for (i = ROUND(new_size, PTMAP); i < MIN(ROUND(old_size, PTMAP), MAXFILESIZE); i += PTMAP) {
+    if (!file_page_mapped(file_va + i)) {
+      continue;
     }
-  }
-
-  // 如果大小变小，则取消映射
-  for (i = ROUND(new_size, PTMAP); i < ROUND(old_size, PTMAP); i += PTMAP) {
     if ((func_info = syscall_mem_unmap(0, file_va + i)) < 0) {
       user_panic("ftruncate: syscall_mem_unmap %08x: %d\n", file_va + i, func_info);
     }
@@ -242,6 +362,80 @@ int ftruncate(int fd_no, u_int new_size) {
   return 0;
 }
 
+// Overview:
+//  Map 'len' bytes of the open file 'fd_no' from 'offset' into memory with protection 'prot',
+//  and store the address in '*va_pointer'. No page is mapped here: each page is mapped from the
+//  file server on its first access. Use 'file_populate' to map a range at once.
+//  The mapping is the data area of the file descriptor, so 'prot' applies to the whole data
+//  area: without PROT_WRITE its pages are mapped read-only, and 'write' on the descriptor
+//  goes through the file server instead.
+//
+// Returns:
+//  0 on success,
+//  -E_INVAL if 'fd_no' is not a file, 'offset' is not page-aligned, the range is beyond
+//  MAXFILESIZE, or 'prot' asks for write access to a file not opened for writing.
+// 将文件中从offset开始的len字节映射到内存中，页面在第一次访问时才被映射
+int mmap(int fd_no, u_int offset, u_int len, int prot, void **va_pointer) {
+  struct Fd *fd;
+
+  try(fd_lookup(fd_no, &fd));
+  if (fd->fd_dev_id != devfile.dev_id) {
+    return -E_INVAL;
+  }
+  if (offset % PAGE_SIZE != 0 || offset > MAXFILESIZE || len > MAXFILESIZE - offset) {
+    return -E_INVAL;
+  }
+  if ((prot & PROT_WRITE) && (fd->fd_omode & O_ACCMODE) == O_RDONLY) {
+    return -E_INVAL;
+  }
+
+  // 已映射的页面按新的保护属性重新映射
+  file_window_ro[fd_no] = !(prot & PROT_WRITE);
+  u_int file_size = ((struct Filefd *)fd)->f_file.f_size;
+  try(file_window_remap(fd, 0, MIN(ROUND(file_size, PTMAP), MAXFILESIZE)));
+  try(file_pager_setup());
+  *va_pointer = fd2data(fd) + offset;
+  return 0;
+}
+
+// Overview:
+//  Map the pages of the open file 'fd_no' covering 'len' bytes from 'offset' now, with as few
+//  requests to the file server as possible, for callers that can't rely on faults (such as the
+//  kernel reading the file in 'sys_spawn').
+//
+// Returns:
+//  0 on success, < 0 on failure.
+// 立即映射文件中一段范围内尚未映射的页面，连续的页面一次请求完成
+int file_populate(int fd_no, u_int offset, u_int len) {
+  struct Fd *fd;
+  int func_info;
+
+  try(fd_lookup(fd_no, &fd));
+  if (fd->fd_dev_id != devfile.dev_id) {
+    return -E_INVAL;
+  }
+  struct Filefd *file_fd = (struct Filefd *)fd;
+  void *file_va = fd2data(fd);
+  u_int end = MIN(ROUND(offset + len, PTMAP), ROUND(file_fd->f_file.f_size, PTMAP));
+  // 只有数据区中的部分可以映射
+  end = MIN(end, MAXFILESIZE);
+
+  for (u_int i = ROUNDDOWN(offset, PTMAP); i < end;) {
+    if (file_page_mapped(file_va + i)) {
+      i += PTMAP;
+      continue;
+    }
+    // 请求映射直到下一个已映射页面之前的全部页面
+    u_int j = i + PTMAP;
+    for (; j < end && !file_page_mapped(file_va + j); j += PTMAP) {
+    }
+    try(func_info = fsipc_map(file_fd->f_fileid, i, (j - i) / PTMAP, file_va + i));
+    try(file_window_remap(fd, i, i + func_info * PTMAP));
+    i += func_info * PTMAP;
+  }
+  return 0;
+}
+
 // Overview:
 //  Delete a file or directory.
 // 按路径移除文件
@@ -53,59 +53,7 @@ static void /*不返回函数*/__attribute__((noreturn)) cow_entry(struct Trapfr
 }
 
 /* Overview:
- *   Grant our child 'envid' access to the virtual page 'vpn' (with address 'vpn' * 'PAGE_SIZE') in
- * our (current env's) address space. 'PTE_COW' should be used to isolate the modifications on
- * unshared memory from a parent and its children.
- *
- * Post-Condition:
- *   If the virtual page 'vpn' has 'PTE_D' and doesn't has 'PTE_LIBRARY', both our original virtual
- *   page and 'envid''s newly-mapped virtual page should be marked 'PTE_COW' and without 'PTE_D',
- *   while the other permission bits are kept.
- *
- *   If not, the newly-mapped virtual page in 'envid' should have the exact same permission as our
- *   original virtual page.
- */
-// 设置子进程的地址空间
-// 将地址空间中需要与子进程共享的页面映射给子进程，需要遍历父进程的大部分用户空间页
-// 修改原先可写、且不是PTE_LIBRARY的页面权限为写时复制
-// 其余页面保持原先的权限即可
-
-// - 只读页面：对于不具有PTE_D权限位的页面，按照相同权限（只读）映射给子进程即可。
-// - 写时复制页面：即具有PTE_COW权限位的页面。
-//   这类页面是**之前的fork时duppage的结果**，且在本次fork前必然未被写入过。
-// - 共享页面：即具有PTE_LIBRARY权限位的页面。
-//   这类页面需要保持**共享可写**的状态，即在父子进程中映射到相同的物理页，使对其进行**修改的结果相互可见**。
-// - 可写页面：即具有PTE_D权限位，且不符合以上特殊情况的页面。
-//   这类页面需要在父进程和子进程的页表项中都使用PTE_COW 权限位进行保护。
-static void duppage(u_int child_envid, u_int page_number) {
-  u_int page_address;
-  u_int permission;
-
-  // 获取当前映射页面的虚拟地址（在父进程中，当然子进程也是这个地址）
-  page_address = page_number << PGSHIFT;
-  // 通过暴露给用户态的页表获取对应页面的权限
-  permission = vpt[page_number] & 0xfff;
-
-  u_int set_to_cow = 0;
-  // 如果页面可写，且不是PTE_LIBRARY，则在父子进程中同时设置为写时复制
-  if ((permission & PTE_D) &&  !(permission & PTE_LIBRARY)) {
-    // 写时复制要求不可写
-    permission = (permission & ~ PTE_D) | PTE_COW;
-    set_to_cow = 1;
-  }
-  // 其余情况保持页面权限不变
-
-  u_int parent_envid = 0;
-  // 设置子进程的虚拟地址空间：共享父进程的页面
-  syscall_mem_map(parent_envid, page_address, child_envid, page_address, permission);
-  // 修改为cow后，对于父进程设置权限，也利用遍历函数：维护操作统一，不添加新的函数
-  if (set_to_cow) {
-    syscall_mem_map(parent_envid, page_address, parent_envid, page_address, permission);
-  }
-}
-
-/* Overview:
- *   User-level 'fork'. Create a child and then copy our address space.
+ *   User-level 'fork'. Create a child with a copy-on-write copy of our address space.
  *   Set up ours and its TLB Mod user exception entry to 'cow_entry'.
  *
  * Post-Conditon:
@@ -113,49 +61,27 @@ static void duppage(u_int child_envid, u_int page_number) {
  */
 // fork()是一个用户态函数！
 // 在此，进程进行分叉，原先的行为逻辑一分为二，开始进行独立的运行
+// 地址空间的复制由内核的sys_fork一次完成：
+// - 内核复制USTACKTOP之下的页表，可写且不是PTE_LIBRARY的页面在父子进程中都设为PTE_COW
+// - 写时复制异常由内核的do_tlb_mod直接处理，cow_entry仅在内核无法处理时（内存不足）使用
 int fork(void) {
-  u_int fork_return_envid;
-  u_int i;
+  int fork_return_envid;
 
-  // 先为父进程设置写时复制异常处理函数
-  // 之后涉及函数调用，会修改用户栈，而用户栈已经被共享给了子进程，会涉及写时复制异常问题
+  // 先为父进程设置写时复制异常处理函数，内核会将其复制给子进程
   if (env->env_user_tlb_mod_entry != (u_int)cow_entry) {
     // 为什么不直接写：能读取的进程块是由内核暴露的，不能进行写操作，由硬件屏蔽
     try(syscall_set_tlb_mod_entry(/*为自己设置*/0, cow_entry));
   }
 
-  // 调用结束后，创建了一个子进程，处于被阻塞状态，需要被设置
-  fork_return_envid = syscall_exofork();
-  // 子进程设置完成后会从这里开始
+  // 调用结束后，创建了一个子进程，已经可以被调度
+  // 子进程的地址空间是调用时刻父进程的快照，父子进程都从这里返回
+  fork_return_envid = syscall_fork();
 
-  // 如果是子进程，涉及函数调用，会修改用户栈
-  // 初始创建子进程后，子进程处于阻塞状态，等待父进程进行调度
   if (fork_return_envid == 0) {
     // 将env指针指向自身进程控制块：根据id得到，之前还指向父进程
     env = envs + ENVX(syscall_getenvid());
     return 0;
   }
 
-  // 由父进程设置子进程的地址空间，同时将父进程页面权限设置为写时复制PTE_COW
-  // duppage对每一个页表项进行操作
-  // - 需要遍历所有USTACKTOP之下的地址空间
-  // - ULIM到USTACKTOP之间的部分，储存的是页表信息、异常处理栈等，不需要共享
-  // - 再往上为内核空间，总被共享
-  for (i = 0; i < VPN(USTACKTOP); i++) {
-    // 在调用 duppage 之前，判断页目录项和页表项是否有效。
-    // 如果不判断则会在 duppage 函数中发生异常（最终是由page_lookup产生的）
-    // vpd是页目录项数组，i相当于地址的高20位，需要取得地址的高10位作为页目录的索引
-    if ((vpd[i >> 10] & PTE_V) && (vpt[i] & PTE_V) ) {
-      duppage(fork_return_envid, i);
-    }
-  }
-
-  // 为子进程设置写时复制异常处理函数，供do_tlb_mod使用
-  // 见tlbex.c
-  try(syscall_set_tlb_mod_entry(fork_return_envid, cow_entry));
-
-  // 对子进程设置完毕，将其设置为可以运行，开始子进程波澜壮阔的一生
-  try(syscall_set_env_status(fork_return_envid, ENV_RUNNABLE));
-
   return fork_return_envid;
 }
@@ -29,15 +29,14 @@ u_char fsipcbuf[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
 // 文件服务IPC，向文件服务进程发送信息，并接受返回信息
 static int fsipc(u_int type, void *request, void *dst_va, u_int *permission) {
   // 强制向第二个进程发送，即文件服务进程，必须使其为第二个进程
-  ipc_send(envs[1].env_id, // 接受进程的envid：必须为文件服务进程
-           type,      // 发送的值：文件操作的类型
-           request,   // 共享的数据虚拟地址，设置为请求类型
-           PTE_D);    // 共享区域的权限
-  // 等待从文件服务接受信息
+  // 发送请求与等待回复合并为一次系统调用，文件服务进程在等待时由内核直接切换过去
   // 接受到的页面的权限由文件服务进程设置
-  // 实际上不关注发送id：肯定是文件服务进程，一定是第二个进程
-  u_int send_id;
-  return ipc_recv(&send_id, dst_va, permission);
+  return ipc_call(envs[1].env_id, // 接受进程的envid：必须为文件服务进程
+                  type,      // 发送的值：文件操作的类型
+                  request,   // 共享的数据虚拟地址，设置为请求类型
+                  PTE_D,     // 共享区域的权限
+                  dst_va,    // 回复页面的映射地址
+                  permission);
 }
 
 // Overview:
@@ -68,32 +67,40 @@ int fsipc_open(const char *path, u_int mode, struct Fd *fd) {
 }
 
 // Overview:
-//  Make a map-block request to the file server. We send the fileid and
-//  the (byte) offset of the desired block in the file, and the server sends
-//  us back a mapping for a page containing that block.
+//  Make a map-block request to the file server. We send the fileid, the
+//  (byte) offset of the first desired block in the file and the number of
+//  blocks, and the server sends us back mappings for pages containing those
+//  blocks, one after another from 'dst_va'. The server may map fewer blocks
+//  than requested, but at least one.
 //
 // Returns:
-//  0 on success,
+//  the number of blocks mapped on success,
 //  < 0 on failure.
-// 将磁盘块加载进内存，建立一个映射
-int fsipc_map(u_int file_id, u_int offset, void *dst_va) {
+// 将磁盘块加载进内存，一次请求建立至多npages个映射
+int fsipc_map(u_int file_id, u_int offset, u_int npages, void *dst_va) {
   int func_info;
   u_int permission;
   // 建立磁盘块映射请求
   struct Fsreq_map *request = (struct Fsreq_map *)fsipcbuf;
   request->req_fileid = file_id;
   request->req_offset = offset;
+  request->req_npages = npages;
 
   // 向文件服务进程发送简历映射请求、
-  if ((func_info = fsipc(FSREQ_MAP, request, dst_va, &permission)) < 0) {
+  // 回复的页面依次映射到dst_va开始的至多npages个页面中
+  if ((func_info = fsipc(FSREQ_MAP, request, (void *)IPC_RECV_VA((u_int)dst_va, npages),
+                         &permission)) < 0) {
     return func_info;
   }
   // 检查共享页面的权限
   if ((permission & ~(PTE_D | PTE_LIBRARY)) != (PTE_V)) {
     user_panic("fsipc_map: unexpected permissions %08x for dstva %08x", permission, dst_va);
   }
+  if (func_info == 0 || func_info != env->env_ipc_npages) {
+    user_panic("fsipc_map: %d blocks replied but %d pages mapped", func_info, env->env_ipc_npages);
+  }
 
-  return 0;
+  return func_info;
 }
 
 // Overview:
@@ -118,12 +125,13 @@ int fsipc_close(u_int file_id) {
 }
 
 // Overview:
-//  Ask the file server to mark a particular file block dirty.
-// 将文件块offest处的磁盘块标记为脏
-int fsipc_dirty(u_int file_id, u_int offset) {
+//  Ask the file server to mark 'npages' file blocks starting at 'offset' dirty.
+// 将文件offest处开始的npages个磁盘块标记为脏
+int fsipc_dirty(u_int file_id, u_int offset, u_int npages) {
   struct Fsreq_dirty *request = (struct Fsreq_dirty *)fsipcbuf;
   request->req_fileid = file_id;
   request->req_offset = offset;
+  request->req_npages = npages;
 
   return fsipc(FSREQ_DIRTY, request, 0, 0);
 }
@@ -154,3 +162,13 @@ int fsipc_remove(const char *path) {
 int fsipc_sync(void) {
   return fsipc(FSREQ_SYNC, fsipcbuf, 0, 0);
 }
+
+// Overview:
+//  Ask the file server for the statistics of its block cache, and copy them to 'stat'.
+// 获取文件服务进程磁盘块缓存的命中、缺失、替换次数
+int fsipc_cache_stat(struct Fsreq_cache_stat *stat) {
+  struct Fsreq_cache_stat *request = (struct Fsreq_cache_stat *)fsipcbuf;
+  try(fsipc(FSREQ_CACHE_STAT, request, 0, 0));
+  *stat = *request;
+  return 0;
+}
@@ -3,25 +3,28 @@
 // 在此可以使用内核态暴露的envs和pages
 
 // IPC的方式：
-// 1. 发送方调用ipc_send，开始忙等待，直至发送成功
+// 1. 发送方调用ipc_send，若接收方未在接收，则在内核中阻塞等待，直至发送成功
 // 2. 需要接收方手动调用ipc_recv，才可以实现一次完整的通信
+// 3. 请求-回复式的通信使用ipc_call与ipc_reply_wait，每个方向只需要一次系统调用
+// 4. 一条消息可以通过ipc_sendv、ipc_reply_waitv共享多个页面片段，
+//    接收方用IPC_RECV_VA(va, npages)指定至多接收的页面数，实际页面数见env->env_ipc_npages
 
 #include <env.h>
 #include <lib.h>
 #include <mmu.h>
 
 // 用户态的ipc_send函数
-// 尝试发送信息直至成功，对CPU不友好，唯一区分的就是是否发送成功，不区分具体情况
+// 发送信息直至成功：接收方未在接收时，在内核的等待队列中阻塞，不再轮询
 // 使用srcva为0的调用来表示只传value值，而不需要传递物理页面，
 void ipc_send(u_int receive_id, u_int value, const void *src_va, u_int perm) {
-  int func_info;
-  // 轮询直至接受到信息
-  // 信息的接受是由接受进程手动设置的，如果对方进程一直不接受，则会一直阻塞
-  while ((func_info = syscall_ipc_try_send(receive_id, value, src_va, perm)) == -E_IPC_NOT_RECV) {
-    // 使用yield（用户态）让出CPU，避免无意义轮询
-    // 没有区分具体的发送失败原因：阻塞/就是失败等
-    syscall_yield();
-  }
+  int func_info = syscall_ipc_send(receive_id, value, src_va, perm);
+
+  user_assert(func_info == 0);
+}
+
+// 发送多个页面片段，直至成功
+void ipc_sendv(u_int receive_id, u_int value, const struct Ipc_seg *segs, u_int nseg) {
+  int func_info = syscall_ipc_sendv(receive_id, value, segs, nseg);
 
   user_assert(func_info == 0);
 }
@@ -54,3 +57,54 @@ u_int ipc_recv(u_int *send_id_pointer, // 记录发送进程的id，通过指针
   // 直接返回共享的值
   return env->env_ipc_value;
 }
+
+// 用户态的ipc_call函数：向whom发送请求，并等待回复
+// 相当于ipc_send后紧接ipc_recv，但只陷入一次内核；对方正在等待时内核直接切换到对方
+// 返回回复的值，回复共享页面的权限通过perm_store返回
+u_int ipc_call(u_int whom, u_int value, const void *src_va, u_int perm, void *dst_va,
+               u_int *perm_store) {
+  int func_info = syscall_ipc_call(whom, value, src_va, perm, dst_va);
+  if (func_info != 0) {
+    user_panic("syscall_ipc_call err: %d", func_info);
+  }
+
+  if (perm_store) {
+    *perm_store = env->env_ipc_perm;
+  }
+  return env->env_ipc_value;
+}
+
+// 用户态的ipc_reply_wait函数：服务进程回复whom的上一个请求，并等待下一个请求
+// whom为0时不回复，只等待请求；返回值与参数from、perm_store同ipc_recv
+u_int ipc_reply_wait(u_int whom, u_int value, const void *src_va, u_int perm, u_int *from,
+                     void *dst_va, u_int *perm_store) {
+  int func_info = syscall_ipc_reply_wait(whom, value, src_va, perm, dst_va);
+  if (func_info != 0) {
+    user_panic("syscall_ipc_reply_wait err: %d", func_info);
+  }
+
+  if (from) {
+    *from = env->env_ipc_from;
+  }
+  if (perm_store) {
+    *perm_store = env->env_ipc_perm;
+  }
+  return env->env_ipc_value;
+}
+
+// 回复whom的上一个请求（共享多个页面片段），并等待下一个请求，其余同ipc_reply_wait
+u_int ipc_reply_waitv(u_int whom, u_int value, const struct Ipc_seg *segs, u_int nseg,
+                      u_int *from, void *dst_va, u_int *perm_store) {
+  int func_info = syscall_ipc_reply_waitv(whom, value, segs, nseg, dst_va);
+  if (func_info != 0) {
+    user_panic("syscall_ipc_reply_waitv err: %d", func_info);
+  }
+
+  if (from) {
+    *from = env->env_ipc_from;
+  }
+  if (perm_store) {
+    *perm_store = env->env_ipc_perm;
+  }
+  return env->env_ipc_value;
+}
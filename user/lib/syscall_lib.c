@@ -42,6 +42,11 @@ int syscall_set_tlb_mod_entry(u_int envid, void (*func)(struct Trapframe *)) {
   return msyscall(SYS_set_tlb_mod_entry, envid, func);
 }
 
+// 注册用户态缺页处理函数及其负责的地址区间
+int syscall_set_pager(u_int envid, void (*func)(struct Trapframe *), u_int va, u_int len) {
+  return msyscall(SYS_set_pager, envid, func, va, len);
+}
+
 // 分配内存：给该程序所允许的虚拟内存空间显式地分配实际的物理内存
 int syscall_mem_alloc(u_int envid, void *va, u_int perm) {
   return msyscall(SYS_mem_alloc, envid, va, perm);
@@ -57,6 +62,16 @@ int syscall_mem_unmap(u_int envid, void *va) {
   return msyscall(SYS_mem_unmap, envid, va);
 }
 
+// 创建子进程，由内核以写时复制的方式复制地址空间，子进程中返回0
+int syscall_fork(void) {
+  return msyscall(SYS_fork);
+}
+
+// 由内核从已映射的可执行文件创建子进程
+int syscall_spawn(const void *binary, u_int size, char **argv) {
+  return msyscall(SYS_spawn, binary, size, argv);
+}
+
 // 根据设定的状态将进程加入或移除调度队列
 int syscall_set_env_status(u_int envid, u_int status) {
   return msyscall(SYS_set_env_status, envid, status);
@@ -78,11 +93,38 @@ int syscall_ipc_try_send(u_int envid, u_int value, const void *src_va, u_int per
   return msyscall(SYS_ipc_try_send, envid, value, src_va, perm);
 }
 
+// 进程间通信阻塞发送信息
+int syscall_ipc_send(u_int envid, u_int value, const void *src_va, u_int perm) {
+  return msyscall(SYS_ipc_send, envid, value, src_va, perm);
+}
+
 // 进程间通信接受信息
 int syscall_ipc_recv(void *dst_va) {
   return msyscall(SYS_ipc_recv, dst_va);
 }
 
+// 进程间通信调用：发送请求并等待回复
+int syscall_ipc_call(u_int envid, u_int value, const void *src_va, u_int perm, void *dst_va) {
+  return msyscall(SYS_ipc_call, envid, value, src_va, perm, dst_va);
+}
+
+// 回复请求并等待下一个请求
+int syscall_ipc_reply_wait(u_int envid, u_int value, const void *src_va, u_int perm,
+                           void *dst_va) {
+  return msyscall(SYS_ipc_reply_wait, envid, value, src_va, perm, dst_va);
+}
+
+// 进程间通信阻塞发送多个页面
+int syscall_ipc_sendv(u_int envid, u_int value, const struct Ipc_seg *segs, u_int nseg) {
+  return msyscall(SYS_ipc_sendv, envid, value, segs, nseg);
+}
+
+// 回复请求（共享多个页面）并等待下一个请求
+int syscall_ipc_reply_waitv(u_int envid, u_int value, const struct Ipc_seg *segs, u_int nseg,
+                            void *dst_va) {
+  return msyscall(SYS_ipc_reply_waitv, envid, value, segs, nseg, dst_va);
+}
+
 // 读入一个字符，一切输入的起始
 int syscall_cgetc() {
   return msyscall(SYS_cgetc);
@@ -97,3 +139,23 @@ int syscall_write_dev(void *data_addr, u_int device_addr, u_int data_len) {
 int syscall_read_dev(void *data_addr, u_int device_addr, u_int data_len) {
   return msyscall(SYS_read_dev, data_addr, device_addr, data_len);
 }
+
+// 向设备寄存器连续写入一段数据，每次写入 width 字节
+int syscall_write_dev_bulk(void *data_addr, u_int device_addr, u_int width, u_int data_len) {
+  return msyscall(SYS_write_dev_bulk, data_addr, device_addr, width, data_len);
+}
+
+// 从设备寄存器连续读入一段数据，每次读入 width 字节
+int syscall_read_dev_bulk(void *data_addr, u_int device_addr, u_int width, u_int data_len) {
+  return msyscall(SYS_read_dev_bulk, data_addr, device_addr, width, data_len);
+}
+
+// 阻塞等待磁盘中断
+int syscall_ide_wait(void) {
+  return msyscall(SYS_ide_wait);
+}
+
+// 通过 DMA 读写磁盘，阻塞至传输完成
+int syscall_ide_dma(u_int disk_no, u_int sec_no, void *va, u_int nsect, int to_disk) {
+  return msyscall(SYS_ide_dma, disk_no, sec_no, va, nsect, to_disk);
+}
@@ -0,0 +1,66 @@
+#include <lib.h>
+#include <syscall.h>
+
+// 批量系统调用：将多个系统调用填入与内核共享的环形队列，通过一次陷入内核全部执行
+// 适用于大量不关心中间结果的调用，例如fork中的页面映射、磁盘的逐字读写
+
+// 环形队列独占一个页面，内核通过该页面读取调用、写回结果
+static struct Sysring sysring __attribute__((aligned(PAGE_SIZE)));
+// 上次执行以来第一个失败的调用的返回值
+static int sysring_error;
+
+/* Overview:
+ *   Queue a system call 'sysno' with its arguments in the ring. If the ring is full, the calls
+ *   already queued are run first. Only 'SYS_mem_alloc', 'SYS_mem_map', 'SYS_mem_unmap',
+ *   'SYS_write_dev' and 'SYS_read_dev' may be queued; the arguments are the same as those of the
+ *   corresponding 'syscall_*' functions.
+ *
+ * Note:
+ *   The call is run later, so memory passed by address (e.g. the data of 'SYS_write_dev') must
+ *   stay unchanged until 'sysring_flush'.
+ */
+// 提交一个系统调用到队列中
+void sysring_submit(u_int sysno, u_int arg1, u_int arg2, u_int arg3, u_int arg4, u_int arg5) {
+  if (sysring.sr_tail - sysring.sr_head == SYSRING_NENT) {
+    sysring_flush();
+  }
+
+  struct Sysring_entry *entry = &sysring.sr_ent[sysring.sr_tail % SYSRING_NENT];
+  entry->se_sysno = sysno;
+  entry->se_args[0] = arg1;
+  entry->se_args[1] = arg2;
+  entry->se_args[2] = arg3;
+  entry->se_args[3] = arg4;
+  entry->se_args[4] = arg5;
+  sysring.sr_tail++;
+}
+
+/* Overview:
+ *   Run all queued system calls with a single trap into the kernel.
+ *
+ * Post-Condition:
+ *   Return 0 if all calls queued since the last flush succeeded, otherwise the return value of
+ *   the first failed one.
+ */
+// 执行队列中的所有系统调用
+int sysring_flush(void) {
+  u_int head = sysring.sr_head;
+
+  if (head != sysring.sr_tail) {
+    int count = msyscall(SYS_sysring_enter, &sysring);
+    if (count < 0) {
+      user_panic("sys_sysring_enter err: %d", count);
+    }
+    // 检查内核写回的结果
+    for (; head != sysring.sr_head; head++) {
+      int ret = sysring.sr_ent[head % SYSRING_NENT].se_ret;
+      if (ret < 0 && sysring_error == 0) {
+        sysring_error = ret;
+      }
+    }
+  }
+
+  int func_info = sysring_error;
+  sysring_error = 0;
+  return func_info;
+}